@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+
+#include <sys/mman.h>
+
+
+// Allocator whose blocks start on an Align-byte boundary, 64 by default:
+// a cache line, and wide enough for aligned AVX-512 loads.
+template <class T, size_t Align = 64>
+class AlignedAllocator {
+    static_assert((Align & (Align - 1)) == 0, "alignment must be a power of two");
+
+public:
+    using value_type = T;
+    static constexpr size_t ALIGN = Align < alignof(T) ? alignof(T) : Align;
+
+    template <class U>
+    struct rebind {
+        using other = AlignedAllocator<U, Align>;
+    };
+
+    AlignedAllocator() {}
+
+    template <class U>
+    AlignedAllocator(const AlignedAllocator<U, Align>&) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(operator new(n * sizeof(T), std::align_val_t(ALIGN)));
+    }
+
+    void deallocate(T* p, size_t) {
+        operator delete(p, std::align_val_t(ALIGN));
+    }
+};
+
+template <class T, class U, size_t Align>
+bool operator==(const AlignedAllocator<T, Align>&, const AlignedAllocator<U, Align>&) {
+    return true;
+}
+
+template <class T, class U, size_t Align>
+bool operator!=(const AlignedAllocator<T, Align>&, const AlignedAllocator<U, Align>&) {
+    return false;
+}
+
+
+// Allocator for big buffers. Blocks of at least THRESHOLD bytes are
+// anonymous mappings aligned to 2 MiB and marked MADV_HUGEPAGE, so the
+// kernel can back them with huge pages and a scan over them misses the
+// TLB far less often; smaller blocks are 64-byte aligned heap memory.
+// reallocate() grows a mapping with mremap, which moves page table entries
+// instead of bytes; Vector uses it for trivially copyable elements.
+template <class T>
+class HugePageAllocator {
+public:
+    using value_type = T;
+    static constexpr size_t HUGEPAGE = 2 << 20;
+    static constexpr size_t THRESHOLD = HUGEPAGE;
+
+    HugePageAllocator() {}
+
+    template <class U>
+    HugePageAllocator(const HugePageAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        size_t bytes = n * sizeof(T);
+        if (bytes < THRESHOLD) {
+            return small.allocate(n);
+        }
+        size_t length = mappedLength(bytes);
+        // Maps one huge page more than needed and trims the ends, so the
+        // block starts on a huge page boundary.
+        char* raw = static_cast<char*>(::mmap(nullptr, length + HUGEPAGE, PROT_READ | PROT_WRITE,
+                                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        if (raw == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        char* p = raw + (HUGEPAGE - reinterpret_cast<uintptr_t>(raw) % HUGEPAGE) % HUGEPAGE;
+        if (p != raw) {
+            ::munmap(raw, p - raw);
+        }
+        ::munmap(p + length, raw + length + HUGEPAGE - (p + length));
+        advise(p, length);
+        return reinterpret_cast<T*>(p);
+    }
+
+    void deallocate(T* p, size_t n) {
+        size_t bytes = n * sizeof(T);
+        if (bytes < THRESHOLD) {
+            small.deallocate(p, n);
+        } else {
+            ::munmap(p, mappedLength(bytes));
+        }
+    }
+
+    // Block of newN elements holding the first min(oldN, newN) elements of
+    // p, which is released. Only for trivially copyable T.
+    T* reallocate(T* p, size_t oldN, size_t newN) {
+        static_assert(std::is_trivially_copyable<T>::value, "reallocate copies bytes");
+        size_t oldBytes = oldN * sizeof(T);
+        size_t newBytes = newN * sizeof(T);
+#ifdef MREMAP_MAYMOVE
+        if (oldBytes >= THRESHOLD && newBytes >= THRESHOLD) {
+            void* res = ::mremap(p, mappedLength(oldBytes), mappedLength(newBytes), MREMAP_MAYMOVE);
+            if (res == MAP_FAILED) {
+                throw std::bad_alloc();
+            }
+            advise(res, mappedLength(newBytes));
+            return static_cast<T*>(res);
+        }
+#endif
+        T* res = allocate(newN);
+        std::memcpy(static_cast<void*>(res), static_cast<const void*>(p), oldBytes < newBytes ? oldBytes : newBytes);
+        deallocate(p, oldN);
+        return res;
+    }
+
+private:
+    static size_t mappedLength(size_t bytes) {
+        return (bytes + HUGEPAGE - 1) / HUGEPAGE * HUGEPAGE;
+    }
+
+    static void advise(void* p, size_t length) {
+#ifdef MADV_HUGEPAGE
+        ::madvise(p, length, MADV_HUGEPAGE);
+#else
+        (void)p;
+        (void)length;
+#endif
+    }
+
+    AlignedAllocator<T> small;
+};
+
+template <class T, class U>
+bool operator==(const HugePageAllocator<T>&, const HugePageAllocator<U>&) {
+    return true;
+}
+
+template <class T, class U>
+bool operator!=(const HugePageAllocator<T>&, const HugePageAllocator<U>&) {
+    return false;
+}
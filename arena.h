@@ -0,0 +1,142 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+// Bump-pointer memory for data that dies all at once, like everything
+// built while serving one request. allocate only moves a pointer forward
+// and deallocate gives back nothing but the latest block; reset() makes
+// the whole arena reusable while keeping its blocks, so a steady load
+// stops calling the global allocator.
+class Arena {
+public:
+    explicit Arena(size_t blockSize = 64 * 1024)
+    : blockSize(blockSize)
+    , current(0)
+    , cur(nullptr)
+    , curEnd(nullptr) {}
+
+    Arena(const Arena&) = delete;
+
+    Arena& operator=(const Arena&) = delete;
+
+    ~Arena() {
+        for (auto& block : blocks) {
+            operator delete(block.first);
+        }
+    }
+
+    void* allocate(size_t bytes, size_t align) {
+        char* res = alignUp(cur, align);
+        if (cur == nullptr || res + bytes > curEnd) {
+            res = nextBlock(bytes, align);
+        }
+        cur = res + bytes;
+        return res;
+    }
+
+    // Only the most recent allocation is actually taken back.
+    void deallocate(void* p, size_t bytes) {
+        if (static_cast<char*>(p) + bytes == cur) {
+            cur = static_cast<char*>(p);
+        }
+    }
+
+    // Everything allocated so far must not be used afterwards.
+    void reset() {
+        current = 0;
+        if (blocks.empty()) {
+            cur = curEnd = nullptr;
+        } else {
+            cur = blocks[0].first;
+            curEnd = cur + blocks[0].second;
+        }
+    }
+
+    size_t blockCount() const {
+        return blocks.size();
+    }
+
+private:
+    static char* alignUp(char* p, size_t align) {
+        uintptr_t v = reinterpret_cast<uintptr_t>(p);
+        return p + ((align - v % align) % align);
+    }
+
+    // Moves on to the first following block with room for the request,
+    // adding a new one if there is none.
+    char* nextBlock(size_t bytes, size_t align) {
+        size_t next = blocks.empty() ? 0 : current + 1;
+        for (; next < blocks.size(); ++next) {
+            char* res = alignUp(blocks[next].first, align);
+            if (res + bytes <= blocks[next].first + blocks[next].second) {
+                break;
+            }
+        }
+        if (next == blocks.size()) {
+            size_t size = std::max(blockSize, bytes + align);
+            blocks.emplace_back(static_cast<char*>(operator new(size)), size);
+        }
+        current = next;
+        curEnd = blocks[next].first + blocks[next].second;
+        return alignUp(blocks[next].first, align);
+    }
+
+    size_t blockSize;
+    std::vector<std::pair<char*, size_t> > blocks;
+    size_t current;
+    char* cur;
+    char* curEnd;
+};
+
+
+// Allocator over an Arena, which must outlive every container using it.
+// Like std::pmr allocators, it stays with its container: assignment
+// copies or moves elements into the left-hand side's arena, and swap needs
+// equal arenas.
+template <class T>
+class ArenaAllocator {
+public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::false_type;
+    using propagate_on_container_move_assignment = std::false_type;
+    using propagate_on_container_swap = std::false_type;
+
+    explicit ArenaAllocator(Arena& arena)
+    : arena(&arena) {}
+
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U>& other)
+    : arena(&other.resource()) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, size_t n) {
+        arena->deallocate(p, n * sizeof(T));
+    }
+
+    Arena& resource() const {
+        return *arena;
+    }
+
+private:
+    Arena* arena;
+};
+
+template <class T, class U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+    return &a.resource() == &b.resource();
+}
+
+template <class T, class U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+    return !(a == b);
+}
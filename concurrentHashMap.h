@@ -0,0 +1,168 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <utility>
+
+#include "hashmap.h"
+
+
+// HashMap split into independently locked shards. Readers of a shard share
+// its lock, so lookups on different keys only contend when a writer holds
+// the same shard.
+template<class KeyType, class ValueType, class Hash = std::hash<KeyType> >
+class ConcurrentHashMap {
+public:
+    const size_t SHARDCOUNT = 64;
+
+    explicit ConcurrentHashMap(Hash hasher = Hash())
+    : ConcurrentHashMap(0, hasher) {}
+
+    // The shard count is rounded up to a power of two.
+    explicit ConcurrentHashMap(size_t shardCount, Hash hasher = Hash())
+    : shardCount(1)
+    , hasher(hasher) {
+        if (shardCount == 0) {
+            shardCount = SHARDCOUNT;
+        }
+        while (this->shardCount < shardCount) {
+            this->shardCount *= 2;
+        }
+        shards.reset(new Shard[this->shardCount]);
+        for (size_t i = 0; i != this->shardCount; ++i) {
+            shards[i].map = HashMap<KeyType, ValueType, Hash>(hasher);
+        }
+    }
+
+    ConcurrentHashMap(const ConcurrentHashMap&) = delete;
+
+    ConcurrentHashMap& operator=(const ConcurrentHashMap&) = delete;
+
+    // Not a snapshot: shards are counted one after another.
+    size_t size() const {
+        size_t res = 0;
+        for (size_t i = 0; i != shardCount; ++i) {
+            std::shared_lock<std::shared_mutex> lock(shards[i].mutex);
+            res += shards[i].map.size();
+        }
+        return res;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    Hash hash_function() const {
+        return hasher;
+    }
+
+    // Copies the value out, as the element may be gone as soon as the lock
+    // is released.
+    bool find(const KeyType& key, ValueType& value) const {
+        const Shard& shard = shardFor(key);
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        auto it = shard.map.find(key);
+        if (it == shard.map.end()) {
+            return false;
+        }
+        value = it->second;
+        return true;
+    }
+
+    bool contains(const KeyType& key) const {
+        const Shard& shard = shardFor(key);
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        return shard.map.find(key) != shard.map.end();
+    }
+
+    // Returns true if the key was inserted and false if it was assigned.
+    template<class V>
+    bool insert_or_assign(const KeyType& key, V&& value) {
+        Shard& shard = shardFor(key);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        auto res = shard.map.try_emplace(key, std::forward<V>(value));
+        if (!res.second) {
+            res.first->second = std::forward<V>(value);
+        }
+        return res.second;
+    }
+
+    template<class... Args>
+    bool try_emplace(const KeyType& key, Args&&... args) {
+        Shard& shard = shardFor(key);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        return shard.map.try_emplace(key, std::forward<Args>(args)...).second;
+    }
+
+    bool erase(const KeyType& key) {
+        Shard& shard = shardFor(key);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        size_t before = shard.map.size();
+        shard.map.erase(key);
+        return shard.map.size() != before;
+    }
+
+    // Calls fn(value) under the shard's exclusive lock. fn must not call
+    // back into the map.
+    template<class F>
+    bool visit(const KeyType& key, F fn) {
+        Shard& shard = shardFor(key);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        auto it = shard.map.find(key);
+        if (it == shard.map.end()) {
+            return false;
+        }
+        fn(it->second);
+        return true;
+    }
+
+    // Same with a shared lock and read-only access to the value.
+    template<class F>
+    bool visit(const KeyType& key, F fn) const {
+        const Shard& shard = shardFor(key);
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        auto it = shard.map.find(key);
+        if (it == shard.map.end()) {
+            return false;
+        }
+        fn(it->second);
+        return true;
+    }
+
+    void clear() {
+        for (size_t i = 0; i != shardCount; ++i) {
+            std::unique_lock<std::shared_mutex> lock(shards[i].mutex);
+            shards[i].map.clear();
+        }
+    }
+
+private:
+    // Each shard sits on its own cache lines so that taking one lock does
+    // not invalidate its neighbours.
+    struct alignas(64) Shard {
+        mutable std::shared_mutex mutex;
+        HashMap<KeyType, ValueType, Hash> map;
+    };
+
+    // HashMap picks the bucket from the low bits of the hash, so the shard
+    // is taken from the high bits of a mixed copy to keep the two apart.
+    size_t shardIndex(const KeyType& key) const {
+        uint64_t h = mixHash(hasher(key));
+        return static_cast<size_t>(h >> 32) & (shardCount - 1);
+    }
+
+    Shard& shardFor(const KeyType& key) {
+        return shards[shardIndex(key)];
+    }
+
+    const Shard& shardFor(const KeyType& key) const {
+        return shards[shardIndex(key)];
+    }
+
+    size_t shardCount;
+    std::unique_ptr<Shard[]> shards;
+    Hash hasher;
+};
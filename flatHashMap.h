@@ -0,0 +1,456 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "hashmap.h"
+
+
+// Control bytes of a full slot hold the low 7 bits of the key's hash; the
+// special states are negative. A Group looks at 16 of them at once and
+// returns a bit mask of the matching positions.
+class FlatHashGroup {
+public:
+    static constexpr size_t kWidth = 16;
+
+    explicit FlatHashGroup(const int8_t* pos) {
+#if defined(__SSE2__)
+        ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos));
+#else
+        lo = load(pos);
+        hi = load(pos + 8);
+#endif
+    }
+
+    uint32_t match(int8_t h2) const {
+#if defined(__SSE2__)
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), ctrl));
+#else
+        uint64_t pattern = 0x0101010101010101ull * static_cast<uint8_t>(h2);
+        return zeroBytes(lo ^ pattern) | zeroBytes(hi ^ pattern) << 8;
+#endif
+    }
+
+    // Slots that are empty or deleted, i.e. below the sentinel value -1.
+    uint32_t matchFree() const {
+#if defined(__SSE2__)
+        return _mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(-1), ctrl));
+#else
+        uint32_t negative = gather(lo & kHigh) | gather(hi & kHigh) << 8;
+        return negative & ~(zeroBytes(~lo) | zeroBytes(~hi) << 8);
+#endif
+    }
+
+    static size_t lowestBit(uint32_t mask) {
+#if defined(__GNUC__)
+        return __builtin_ctz(mask);
+#else
+        size_t i = 0;
+        while (!(mask & 1)) {
+            mask >>= 1;
+            ++i;
+        }
+        return i;
+#endif
+    }
+
+private:
+#if defined(__SSE2__)
+    __m128i ctrl;
+#else
+    // Portable fallback: each half of the group is a 64-bit word and the
+    // byte tests are done with carry-free bit tricks.
+    static constexpr uint64_t kHigh = 0x8080808080808080ull;
+    static constexpr uint64_t kLow7 = 0x7F7F7F7F7F7F7F7Full;
+
+    static uint64_t load(const int8_t* p) {
+        uint64_t w;
+        std::memcpy(&w, p, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        w = __builtin_bswap64(w);
+#endif
+        return w;
+    }
+
+    // Packs the high bit of every byte into an 8-bit mask.
+    static uint32_t gather(uint64_t highBits) {
+        return static_cast<uint32_t>(((highBits >> 7) * 0x0102040810204080ull) >> 56);
+    }
+
+    static uint32_t zeroBytes(uint64_t x) {
+        return gather(~(((x & kLow7) + kLow7) | x | kLow7));
+    }
+
+    uint64_t lo;
+    uint64_t hi;
+#endif
+};
+
+
+// Open-addressing counterpart of HashMap (hashmap.h) with the same interface.
+// Entries live in one contiguous slot array and a parallel array of control
+// bytes tells whether a slot is empty, deleted or full. Slots are probed in
+// aligned groups of 16 and the full key is compared only when the 7-bit hash
+// fingerprint stored in the control byte matches.
+template<class KeyType, class ValueType, class Hash = std::hash<KeyType> >
+class FlatHashMap {
+public:
+    using value_type = std::pair<const KeyType, ValueType>;
+
+private:
+    static constexpr int8_t kEmpty = -128;
+    static constexpr int8_t kDeleted = -2;
+    static constexpr int8_t kSentinel = -1;
+
+    using Group = FlatHashGroup;
+
+    static bool isFull(int8_t c) {
+        return c >= 0;
+    }
+
+    static size_t h1(size_t hash) {
+        return hash >> 7;
+    }
+
+    static int8_t h2(size_t hash) {
+        return static_cast<int8_t>(hash & 0x7F);
+    }
+
+    template<bool IsConst>
+    class Iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = typename FlatHashMap::value_type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = typename std::conditional<IsConst, const value_type*, value_type*>::type;
+        using reference = typename std::conditional<IsConst, const value_type&, value_type&>::type;
+
+        Iterator() : ctrl(nullptr), slot(nullptr) {}
+
+        Iterator(const int8_t* c, pointer s) : ctrl(c), slot(s) {}
+
+        operator Iterator<true>() const {
+            return Iterator<true>(ctrl, slot);
+        }
+
+        reference operator*() const {
+            return *slot;
+        }
+
+        pointer operator->() const {
+            return slot;
+        }
+
+        Iterator& operator++() {
+            ++ctrl;
+            ++slot;
+            skipFree();
+            return *this;
+        }
+
+        Iterator operator++(int) {
+            Iterator tmp = *this;
+            ++*this;
+            return tmp;
+        }
+
+        friend bool operator==(const Iterator& a, const Iterator& b) {
+            return a.slot == b.slot;
+        }
+
+        friend bool operator!=(const Iterator& a, const Iterator& b) {
+            return a.slot != b.slot;
+        }
+
+    private:
+        friend class FlatHashMap;
+
+        void skipFree() {
+            while (*ctrl < kSentinel) {
+                ++ctrl;
+                ++slot;
+            }
+        }
+
+        const int8_t* ctrl;
+        pointer slot;
+    };
+
+public:
+    const size_t TABLESIZE = Group::kWidth;
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
+
+    explicit FlatHashMap(Hash hasher = Hash())
+    : ctrl(nullptr)
+    , slots(nullptr)
+    , sz(0)
+    , deleted(0)
+    , cp(0)
+    , hasher(hasher) {
+        allocate(TABLESIZE);
+    }
+
+    template<class Iter>
+    FlatHashMap(Iter first, Iter last, Hash hasher = Hash())
+    : FlatHashMap(hasher) {
+        while (first != last) {
+            insert(*first);
+            ++first;
+        }
+    }
+
+    explicit FlatHashMap(std::initializer_list<std::pair<KeyType, ValueType> > l, Hash hasher = Hash())
+    : FlatHashMap(l.begin(), l.end(), hasher) {}
+
+    FlatHashMap(const FlatHashMap& hm)
+    : FlatHashMap(hm.hash_function()) {
+        for (const auto& elem : hm) {
+            insert(elem);
+        }
+    }
+
+    FlatHashMap(FlatHashMap&& hm)
+    : ctrl(nullptr)
+    , slots(nullptr)
+    , sz(0)
+    , deleted(0)
+    , cp(0)
+    , hasher(Hash()) {
+        allocate(TABLESIZE);
+        swap(hm);
+    }
+
+    FlatHashMap& operator=(FlatHashMap rhs) {
+        swap(rhs);
+        return *this;
+    }
+
+    ~FlatHashMap() {
+        destroyAll();
+        release();
+    }
+
+    size_t size() const {
+        return sz;
+    }
+
+    bool empty() const {
+        return sz == 0;
+    }
+
+    Hash hash_function() const {
+        return hasher;
+    }
+
+    void rebuild(size_t newSize) {
+        size_t newCp = TABLESIZE;
+        while (newCp < newSize || sz * 8 >= newCp * 7) {
+            newCp *= 2;
+        }
+
+        int8_t* oldCtrl = ctrl;
+        value_type* oldSlots = slots;
+        size_t oldCp = cp;
+        allocate(newCp);
+
+        for (size_t i = 0; i != oldCp; ++i) {
+            if (isFull(oldCtrl[i])) {
+                size_t hash = hashOf(oldSlots[i].first);
+                size_t pos = freeSlot(hash);
+                new (slots + pos) value_type(std::move(oldSlots[i]));
+                ctrl[pos] = h2(hash);
+                oldSlots[i].~value_type();
+            }
+        }
+        deleted = 0;
+
+        delete[] oldCtrl;
+        operator delete(oldSlots);
+    }
+
+    iterator find(const KeyType& key) {
+        size_t pos = lookup(key, hashOf(key));
+        if (pos == cp) {
+            return end();
+        }
+        return iterator(ctrl + pos, slots + pos);
+    }
+
+    const_iterator find(const KeyType& key) const {
+        size_t pos = lookup(key, hashOf(key));
+        if (pos == cp) {
+            return end();
+        }
+        return const_iterator(ctrl + pos, slots + pos);
+    }
+
+    iterator insert(const std::pair<KeyType, ValueType>& p) {
+        size_t hash = hashOf(p.first);
+        if (lookup(p.first, hash) != cp) {
+            return end();
+        }
+        if ((sz + deleted + 1) * 8 > cp * 7) {
+            rebuild(sz * 2 >= cp ? cp * 2 : cp);
+        }
+        size_t pos = freeSlot(hash);
+        new (slots + pos) value_type(p);
+        if (ctrl[pos] == kDeleted) {
+            --deleted;
+        }
+        ctrl[pos] = h2(hash);
+        ++sz;
+        return iterator(ctrl + pos, slots + pos);
+    }
+
+    void erase(const KeyType& key) {
+        size_t pos = lookup(key, hashOf(key));
+        if (pos == cp) {
+            return;
+        }
+        slots[pos].~value_type();
+        // A probe stops at the first group that has an empty slot, so if the
+        // group of pos has one, no tombstone is needed.
+        Group g(ctrl + pos / Group::kWidth * Group::kWidth);
+        if (g.match(kEmpty)) {
+            ctrl[pos] = kEmpty;
+        } else {
+            ctrl[pos] = kDeleted;
+            ++deleted;
+        }
+        --sz;
+    }
+
+    iterator begin() {
+        iterator it(ctrl, slots);
+        it.skipFree();
+        return it;
+    }
+
+    const_iterator begin() const {
+        const_iterator it(ctrl, slots);
+        it.skipFree();
+        return it;
+    }
+
+    iterator end() {
+        return iterator(ctrl + cp, slots + cp);
+    }
+
+    const_iterator end() const {
+        return const_iterator(ctrl + cp, slots + cp);
+    }
+
+    ValueType& operator[] (const KeyType& key) {
+        auto it = find(key);
+        if (it == end()) {
+            return insert({key, ValueType()})->second;
+        }
+        return it->second;
+    }
+
+    const ValueType& at(const KeyType& key) const {
+        auto it = find(key);
+        if (it == end()) {
+            throw std::out_of_range("");
+        }
+        return it->second;
+    }
+
+    void clear() {
+        destroyAll();
+        std::memset(ctrl, kEmpty, cp);
+        sz = 0;
+        deleted = 0;
+    }
+
+    void swap(FlatHashMap& other) {
+        std::swap(ctrl, other.ctrl);
+        std::swap(slots, other.slots);
+        std::swap(sz, other.sz);
+        std::swap(deleted, other.deleted);
+        std::swap(cp, other.cp);
+        std::swap(hasher, other.hasher);
+    }
+
+private:
+    void allocate(size_t n) {
+        slots = static_cast<value_type*>(operator new(n * sizeof(value_type)));
+        ctrl = new int8_t[n + 1];
+        std::memset(ctrl, kEmpty, n);
+        ctrl[n] = kSentinel;
+        cp = n;
+    }
+
+    void release() {
+        delete[] ctrl;
+        operator delete(slots);
+    }
+
+    void destroyAll() {
+        for (size_t i = 0; i != cp; ++i) {
+            if (isFull(ctrl[i])) {
+                slots[i].~value_type();
+            }
+        }
+    }
+
+    // Group index and fingerprint are taken from different bits, so weak
+    // hashes such as the identity std::hash<int> are scrambled first.
+    size_t hashOf(const KeyType& key) const {
+        uint64_t h = mixHash(hasher(key));
+        return static_cast<size_t>(h ^ (h >> 32));
+    }
+
+    // Groups are visited in triangular order, which covers every group of a
+    // power-of-two table.
+    size_t lookup(const KeyType& key, size_t hash) const {
+        size_t mask = cp / Group::kWidth - 1;
+        size_t group = h1(hash) & mask;
+        for (size_t step = 1; ; ++step) {
+            size_t base = group * Group::kWidth;
+            Group g(ctrl + base);
+            for (uint32_t m = g.match(h2(hash)); m != 0; m &= m - 1) {
+                size_t pos = base + Group::lowestBit(m);
+                if (slots[pos].first == key) {
+                    return pos;
+                }
+            }
+            if (g.match(kEmpty)) {
+                return cp;
+            }
+            group = (group + step) & mask;
+        }
+    }
+
+    size_t freeSlot(size_t hash) const {
+        size_t mask = cp / Group::kWidth - 1;
+        size_t group = h1(hash) & mask;
+        for (size_t step = 1; ; ++step) {
+            uint32_t m = Group(ctrl + group * Group::kWidth).matchFree();
+            if (m != 0) {
+                return group * Group::kWidth + Group::lowestBit(m);
+            }
+            group = (group + step) & mask;
+        }
+    }
+
+    int8_t* ctrl;
+    value_type* slots;
+    size_t sz;
+    size_t deleted;
+    size_t cp;
+    Hash hasher;
+};
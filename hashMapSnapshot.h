@@ -0,0 +1,243 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hashmap.h"
+
+
+// File layout shared by writeSnapshot and HashMapView: the header, one
+// control byte per slot (0 empty, 1 full), then the slots, each a key
+// followed by its value. Slots are an open-addressing table with linear
+// probing at a load of at most 0.5.
+struct HashMapSnapshotHeader {
+    char magic[8];
+    uint32_t keySize;
+    uint32_t valueSize;
+    uint64_t capacity;
+    uint64_t size;
+    uint64_t slotsOffset;
+};
+
+template<class KeyType, class ValueType>
+struct HashMapSnapshotSlot {
+    KeyType key;
+    ValueType value;
+};
+
+inline const char* hashMapSnapshotMagic() {
+    return "HMSNAP1";
+}
+
+// Slot of a hash in a table of capacity slots. The hash is mixed first as
+// the low bits of std::hash on integers are the integers themselves.
+inline size_t hashMapSnapshotSlot(size_t hash, uint64_t capacity) {
+    uint64_t h = mixHash(hash);
+    return static_cast<size_t>((h ^ (h >> 32)) & (capacity - 1));
+}
+
+
+// Writes map (HashMap or anything iterable over key/value pairs with a
+// hash_function()) to path. The hash must give the same values in the
+// process that maps the file. The table is written to path + ".tmp",
+// synced to disk and then renamed over path, so a reader or a crash sees
+// either the old file or the new one whole, and views still mapping the
+// old file keep their pages.
+template<class Map>
+void writeSnapshot(const Map& map, const std::string& path) {
+    using KeyType = typename std::remove_const<typename Map::value_type::first_type>::type;
+    using ValueType = typename Map::value_type::second_type;
+    using Slot = HashMapSnapshotSlot<KeyType, ValueType>;
+    static_assert(std::is_trivially_copyable<KeyType>::value, "keys must be trivially copyable");
+    static_assert(std::is_trivially_copyable<ValueType>::value, "values must be trivially copyable");
+
+    uint64_t capacity = 2;
+    while (capacity < map.size() * 2) {
+        capacity *= 2;
+    }
+
+    HashMapSnapshotHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, hashMapSnapshotMagic(), sizeof(header.magic));
+    header.keySize = sizeof(KeyType);
+    header.valueSize = sizeof(ValueType);
+    header.capacity = capacity;
+    header.size = map.size();
+    header.slotsOffset = (sizeof(header) + capacity + alignof(Slot) - 1) / alignof(Slot) * alignof(Slot);
+
+    size_t length = header.slotsOffset + capacity * sizeof(Slot);
+    std::string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("cannot create " + tmp);
+    }
+    auto fail = [&](const std::string& what) {
+        ::close(fd);
+        ::unlink(tmp.c_str());
+        throw std::runtime_error(what + tmp);
+    };
+    if (::ftruncate(fd, length) != 0) {
+        fail("cannot resize ");
+    }
+    void* base = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        fail("cannot map ");
+    }
+
+    // The file starts out zeroed, so every slot is empty.
+    char* image = static_cast<char*>(base);
+    char* ctrl = image + sizeof(header);
+    char* slots = image + header.slotsOffset;
+    auto hasher = map.hash_function();
+    for (const auto& elem : map) {
+        size_t pos = hashMapSnapshotSlot(hasher(elem.first), capacity);
+        while (ctrl[pos]) {
+            pos = (pos + 1) & (capacity - 1);
+        }
+        ctrl[pos] = 1;
+        // Zeroed first, so padding does not carry stray bytes to disk.
+        Slot slot;
+        std::memset(static_cast<void*>(&slot), 0, sizeof(Slot));
+        std::memcpy(&slot.key, &elem.first, sizeof(KeyType));
+        std::memcpy(&slot.value, &elem.second, sizeof(ValueType));
+        std::memcpy(slots + pos * sizeof(Slot), &slot, sizeof(Slot));
+    }
+    std::memcpy(image, &header, sizeof(header));
+
+    int res = ::msync(base, length, MS_SYNC);
+    ::munmap(base, length);
+    if (res != 0 || ::fsync(fd) != 0) {
+        fail("cannot write ");
+    }
+    ::close(fd);
+    if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+        ::unlink(tmp.c_str());
+        throw std::runtime_error("cannot replace " + path);
+    }
+}
+
+
+// Read-only map over a file written by writeSnapshot. The file is mapped
+// into memory and find answers straight from the mapped pages: opening
+// costs the same for any table size and nothing is copied or allocated
+// per entry. Hash must match the one the snapshot was written with.
+template<class KeyType, class ValueType, class Hash = std::hash<KeyType>,
+         class KeyEqual = std::equal_to<KeyType> >
+class HashMapView {
+public:
+    using Slot = HashMapSnapshotSlot<KeyType, ValueType>;
+
+    explicit HashMapView(const std::string& path, Hash hasher = Hash(), KeyEqual equal = KeyEqual())
+    : base(nullptr)
+    , length(0)
+    , header(nullptr)
+    , ctrl(nullptr)
+    , slots(nullptr)
+    , hasher(hasher)
+    , equal(equal) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("cannot open " + path);
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(HashMapSnapshotHeader)) {
+            ::close(fd);
+            throw std::runtime_error("not a snapshot: " + path);
+        }
+        length = st.st_size;
+        base = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (base == MAP_FAILED) {
+            base = nullptr;
+            throw std::runtime_error("cannot map " + path);
+        }
+
+        header = static_cast<const HashMapSnapshotHeader*>(base);
+        // Written so that no sum or product can overflow on a crafted file.
+        if (std::memcmp(header->magic, hashMapSnapshotMagic(), sizeof(header->magic)) != 0
+                || header->keySize != sizeof(KeyType)
+                || header->valueSize != sizeof(ValueType)
+                || header->capacity == 0
+                || (header->capacity & (header->capacity - 1)) != 0
+                || header->size > header->capacity / 2
+                || header->slotsOffset > length
+                || header->slotsOffset < sizeof(HashMapSnapshotHeader)
+                || header->slotsOffset - sizeof(HashMapSnapshotHeader) < header->capacity
+                || header->slotsOffset % alignof(Slot) != 0
+                || header->capacity > (length - header->slotsOffset) / sizeof(Slot)) {
+            ::munmap(base, length);
+            throw std::runtime_error("not a snapshot of this map type: " + path);
+        }
+        ctrl = static_cast<const char*>(base) + sizeof(HashMapSnapshotHeader);
+        slots = reinterpret_cast<const Slot*>(static_cast<const char*>(base) + header->slotsOffset);
+    }
+
+    HashMapView(const HashMapView&) = delete;
+
+    HashMapView& operator=(const HashMapView&) = delete;
+
+    ~HashMapView() {
+        if (base != nullptr) {
+            ::munmap(base, length);
+        }
+    }
+
+    size_t size() const {
+        return header->size;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    // Pointer into the mapped file, or nullptr if the key is missing. At
+    // most capacity slots are probed, even if the file has no empty slot.
+    const ValueType* find(const KeyType& key) const {
+        uint64_t mask = header->capacity - 1;
+        size_t pos = hashMapSnapshotSlot(hasher(key), header->capacity);
+        for (uint64_t probe = 0; probe != header->capacity && ctrl[pos]; ++probe) {
+            if (equal(slots[pos].key, key)) {
+                return &slots[pos].value;
+            }
+            pos = (pos + 1) & mask;
+        }
+        return nullptr;
+    }
+
+    bool contains(const KeyType& key) const {
+        return find(key) != nullptr;
+    }
+
+    const ValueType& at(const KeyType& key) const {
+        const ValueType* value = find(key);
+        if (value == nullptr) {
+            throw std::out_of_range("");
+        }
+        return *value;
+    }
+
+    // Hint for tables that are about to be scanned heavily.
+    void prefault() const {
+        ::madvise(base, length, MADV_WILLNEED);
+    }
+
+private:
+    void* base;
+    size_t length;
+    const HashMapSnapshotHeader* header;
+    const char* ctrl;
+    const Slot* slots;
+    Hash hasher;
+    KeyEqual equal;
+};
@@ -1,61 +1,265 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
 #include <list>
+#include <memory>
+#include <new>
 #include <numeric>
 #include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 
-template<class KeyType, class ValueType, class Hash = std::hash<KeyType> > 
+// Multiplies hash by 2^64 / phi (Fibonacci hashing), so every input bit
+// reaches the high bits of the result. Tables that take a slot, shard or
+// fingerprint from other bits than the low ones HashMap uses mix the hash
+// with it first, as the low bits of std::hash on integers are the integers
+// themselves.
+inline uint64_t mixHash(size_t hash) {
+    return static_cast<uint64_t>(hash) * 0x9E3779B97F4A7C15ull;
+}
+
+// Hash for std::string keys that also accepts std::string_view and
+// const char* without building a std::string. Use it together with
+// std::equal_to<> to enable HashMap's heterogeneous lookup.
+struct StringHash {
+    using is_transparent = void;
+
+    size_t operator()(std::string_view s) const {
+        return std::hash<std::string_view>()(s);
+    }
+};
+
+
+// List node of HashMap: the element itself plus, when CacheHash is set,
+// its full hash, so that growing the table never calls the hasher and most
+// mismatching keys are rejected without comparing them.
+// Inherited constructors leave out copying and moving a Value, so those
+// are spelled out.
+template<class Value, bool CacheHash>
+struct HashMapEntry : Value {
+    using Value::Value;
+
+    HashMapEntry(const Value& v) : Value(v) {}
+
+    HashMapEntry(Value&& v) : Value(std::move(v)) {}
+
+    size_t hash = 0;
+};
+
+template<class Value>
+struct HashMapEntry<Value, false> : Value {
+    using Value::Value;
+
+    HashMapEntry(const Value& v) : Value(v) {}
+
+    HashMapEntry(Value&& v) : Value(std::move(v)) {}
+};
+
+// Snapshot returned by HashMap::stats(). A probe is one element of a bucket
+// compared against the key; bucketLengths[n] is the number of buckets
+// holding n elements. With a well-spread hash the histogram stays close to
+// Poisson with mean load_factor(). The counters are only kept by a map
+// with the HashMapCounters policy and stay zero otherwise.
+struct HashMapStats {
+    size_t finds = 0;
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t probes = 0;
+    size_t rehashes = 0;
+    std::chrono::nanoseconds rehashTime{0};
+    std::vector<size_t> bucketLengths;
+
+    double probesPerFind() const {
+        return finds == 0 ? 0 : static_cast<double>(probes) / finds;
+    }
+
+    size_t maxBucketLength() const {
+        return bucketLengths.empty() ? 0 : bucketLengths.size() - 1;
+    }
+};
+
+// Stats policy of a HashMap that counts nothing; every hook compiles away.
+struct HashMapNoStats {
+    static constexpr bool enabled = false;
+
+    void addFind(size_t, bool) {}
+
+    void addRehash() {}
+
+    void addRehashTime(std::chrono::nanoseconds) {}
+
+    void fill(HashMapStats&) const {}
+};
+
+// Stats policy that counts finds and rehashes. The counters are relaxed
+// atomics, so lookups running side by side under a shared lock, as in
+// ConcurrentHashMap and ReadMostlyHashMap, may all update them.
+class HashMapCounters {
+public:
+    static constexpr bool enabled = true;
+
+    HashMapCounters() = default;
+
+    HashMapCounters(const HashMapCounters& other) {
+        *this = other;
+    }
+
+    HashMapCounters& operator=(const HashMapCounters& other) {
+        finds.store(other.finds.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        hits.store(other.hits.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        probes.store(other.probes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        rehashes.store(other.rehashes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        rehashTime.store(other.rehashTime.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        return *this;
+    }
+
+    void addFind(size_t probeCount, bool hit) {
+        finds.fetch_add(1, std::memory_order_relaxed);
+        probes.fetch_add(probeCount, std::memory_order_relaxed);
+        if (hit) {
+            hits.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void addRehash() {
+        rehashes.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void addRehashTime(std::chrono::nanoseconds t) {
+        rehashTime.fetch_add(t.count(), std::memory_order_relaxed);
+    }
+
+    void fill(HashMapStats& res) const {
+        res.finds = finds.load(std::memory_order_relaxed);
+        res.hits = hits.load(std::memory_order_relaxed);
+        res.misses = res.finds - res.hits;
+        res.probes = probes.load(std::memory_order_relaxed);
+        res.rehashes = rehashes.load(std::memory_order_relaxed);
+        res.rehashTime = std::chrono::nanoseconds(rehashTime.load(std::memory_order_relaxed));
+    }
+
+private:
+    std::atomic<size_t> finds{0};
+    std::atomic<size_t> hits{0};
+    std::atomic<size_t> probes{0};
+    std::atomic<size_t> rehashes{0};
+    std::atomic<std::chrono::nanoseconds::rep> rehashTime{0};
+};
+
+
+// Allocator serves the list nodes that hold the entries; see PoolAllocator
+// in poolAllocator.h for one that pools them. Stats is HashMapNoStats or
+// HashMapCounters; the counting happens only with the latter.
+template<class KeyType, class ValueType, class Hash = std::hash<KeyType>,
+         class KeyEqual = std::equal_to<KeyType>, bool CacheHash = false,
+         class Allocator = std::allocator<std::pair<const KeyType, ValueType> >,
+         class Stats = HashMapNoStats>
 class HashMap {
+private:
+    using Entry = HashMapEntry<std::pair<const KeyType, ValueType>, CacheHash>;
+    using EntryList = std::list<Entry, typename std::allocator_traits<Allocator>::template rebind_alloc<Entry> >;
+
+    template<class H, class E, class = void>
+    struct IsTransparent : std::false_type {};
+
+    template<class H, class E>
+    struct IsTransparent<H, E, std::void_t<typename H::is_transparent, typename E::is_transparent> >
+    : std::true_type {};
+
+    // Lookups with a key of another type K are only enabled when both the
+    // hash and the equality accept it directly, like in std::unordered_map.
+    template<class K, class H>
+    using EnableIfTransparent = typename std::enable_if<IsTransparent<H, KeyEqual>::value>::type;
+
 public:
+    // Bucket counts are powers of two, so a bucket is picked by masking the
+    // hash.
     const size_t TABLESIZE = 2;
-    using iterator = typename std::list<std::pair<const KeyType, ValueType> >::iterator;
-    using const_iterator = typename std::list<std::pair<const KeyType, ValueType> >::const_iterator;
+    // Old buckets moved to the new table by every insert and erase while
+    // the table is being grown; more for max load factors below
+    // 1 / REHASHSTEP, see migrateStep.
+    const size_t REHASHSTEP = 4;
+    // Keys hashed and prefetched together by find_batch and insert_batch.
+    static constexpr size_t BATCHSIZE = 16;
+    using value_type = std::pair<const KeyType, ValueType>;
+    using key_equal = KeyEqual;
+    using allocator_type = Allocator;
+    using iterator = typename EntryList::iterator;
+    using const_iterator = typename EntryList::const_iterator;
 
-    explicit HashMap(Hash hasher = Hash())
-    : lst()
+    explicit HashMap(Hash hasher = Hash(), KeyEqual equal = KeyEqual(),
+                     const Allocator& alloc = Allocator())
+    : lst(alloc)
     , sz(0)
     , table(TABLESIZE, {lst.end(), 0})
-    , hasher(hasher) {}
+    , oldTable()
+    , migrated(0)
+    , maxLoad(0.5)
+    , hasher(hasher)
+    , equal(equal) {}
 
     template<class Iter>
-    HashMap(Iter first, Iter last, Hash hasher = Hash())
-    : lst()
+    HashMap(Iter first, Iter last, Hash hasher = Hash(), KeyEqual equal = KeyEqual(),
+            const Allocator& alloc = Allocator())
+    : lst(alloc)
     , sz(0)
     , table(TABLESIZE, {lst.end(), 0})
-    , hasher(hasher) {
+    , oldTable()
+    , migrated(0)
+    , maxLoad(0.5)
+    , hasher(hasher)
+    , equal(equal) {
         while (first != last) {
             insert(*first);
             ++first;
         }
     }
 
-    explicit HashMap(std::initializer_list<std::pair<KeyType, ValueType> > l, Hash hasher = Hash())
-    : HashMap(l.begin(), l.end(), hasher) {}
+    explicit HashMap(std::initializer_list<std::pair<KeyType, ValueType> > l,
+                     Hash hasher = Hash(), KeyEqual equal = KeyEqual(),
+                     const Allocator& alloc = Allocator())
+    : HashMap(l.begin(), l.end(), hasher, equal, alloc) {}
 
-    HashMap(const HashMap<KeyType, ValueType, Hash>& hm)
-    : lst()
+    HashMap(const HashMap& hm)
+    : lst(std::allocator_traits<Allocator>::select_on_container_copy_construction(hm.get_allocator()))
     , sz(0)
     , table(TABLESIZE, {lst.end(), 0})
-    , hasher(hm.hash_function()) {
+    , oldTable()
+    , migrated(0)
+    , maxLoad(hm.max_load_factor())
+    , hasher(hm.hash_function())
+    , equal(hm.key_eq()) {
+        reserve(hm.size());
         for (const auto& elem : hm) {
-            insert(elem);
+            auto node = lst.insert(lst.end(), elem);
+            relink(table[hashOf(elem) & (table.size() - 1)], lst, node);
+            ++sz;
         }
     }
 
-    HashMap(HashMap<KeyType, ValueType, Hash>&& hm)
-    : lst()
+    HashMap(HashMap&& hm)
+    : lst(hm.get_allocator())
     , sz(0)
     , table(TABLESIZE, {lst.end(), 0})
-    , hasher(Hash()) {
+    , oldTable()
+    , migrated(0)
+    , maxLoad(0.5)
+    , hasher(Hash())
+    , equal(KeyEqual()) {
         swap(hm);
     }
 
-    HashMap<KeyType, ValueType, Hash>& operator=(HashMap<KeyType, ValueType, Hash> rhs) {
-        swap(rhs);
-        return *this;
-    }
-
-    HashMap<KeyType, ValueType, Hash>& operator=(HashMap<KeyType, ValueType, Hash>&& rhs) {
+    HashMap& operator=(HashMap rhs) {
         swap(rhs);
         return *this;
     }
@@ -72,96 +276,214 @@ public:
         return hasher;
     }
 
+    KeyEqual key_eq() const {
+        return equal;
+    }
+
+    Allocator get_allocator() const {
+        return Allocator(lst.get_allocator());
+    }
+
+    size_t bucket_count() const {
+        return table.size();
+    }
+
+    float load_factor() const {
+        return static_cast<float>(sz) / table.size();
+    }
+
+    float max_load_factor() const {
+        return maxLoad;
+    }
+
+    // The table grows once an insert finds it loaded above ml, which must
+    // be positive.
+    void max_load_factor(float ml) {
+        if (!(ml > 0)) {
+            throw std::invalid_argument("max load factor must be positive");
+        }
+        maxLoad = ml;
+    }
+
+    // Relinks the existing nodes into a table of at least newSize buckets;
+    // no element is copied or moved.
     void rebuild(size_t newSize) {
-        table.assign(newSize, {lst.end(), 0});
-        std::list<std::pair<const KeyType, ValueType> > tmp;
-        std::swap(tmp, lst);
-        sz = 0;
-        for (const auto& elem : tmp) {
-            insert(elem);
+        size_t buckets = TABLESIZE;
+        while (buckets < newSize) {
+            buckets *= 2;
+        }
+        RehashTimer timer(counters);
+        counters.addRehash();
+        oldTable.clear();
+        migrated = 0;
+        table.assign(buckets, {lst.end(), 0});
+        EntryList tmp(lst.get_allocator());
+        tmp.splice(tmp.end(), lst);
+        while (!tmp.empty()) {
+            auto node = tmp.begin();
+            relink(table[hashOf(*node) & (buckets - 1)], tmp, node);
+        }
+    }
+
+    // Like std::unordered_map::rehash: at least count buckets, and enough
+    // of them to stay within the max load factor.
+    void rehash(size_t count) {
+        rebuild(std::max(count, bucketsFor(sz)));
+    }
+
+    // Makes room for n elements, so inserting up to n keys never grows the
+    // table.
+    void reserve(size_t n) {
+        if (n > table.size() * maxLoad) {
+            rebuild(bucketsFor(n));
         }
     }
 
     iterator find(const KeyType& key) {
-        size_t hash = hasher(key) % table.size();
-        auto it = table[hash].first;
-        auto len = table[hash].second;
-        size_t i = 0;
-        while (it != lst.end() && i != len) {
-            if (it->first == key) {
-                return it;
-            }
-            ++it;
-            ++i;
+        size_t hash = hasher(key);
+        iterator it;
+        if (lookup(bucket(hash), key, hash, it)) {
+            return it;
         }
         return lst.end();
     }
 
     const_iterator find(const KeyType& key) const {
-        size_t hash = hasher(key) % table.size();
-        auto it = table[hash].first;
-        auto len = table[hash].second;
-        size_t i = 0;
-        while (it != lst.end() && i != len) {
-            if (it->first == key) {
-                return it;
-            }
-            ++it;
-            ++i;
+        size_t hash = hasher(key);
+        iterator it;
+        if (lookup(bucket(hash), key, hash, it)) {
+            return it;
         }
         return lst.end();
     }
 
-    iterator insert(const std::pair<KeyType, ValueType>& p) {
-        if (sz * 2 > table.size()) {
-            rebuild(table.size() * 2);
+    template<class K, class H = Hash, class = EnableIfTransparent<K, H> >
+    iterator find(const K& key) {
+        size_t hash = hasher(key);
+        iterator it;
+        if (lookup(bucket(hash), key, hash, it)) {
+            return it;
         }
-        const KeyType & key = p.first;
-        size_t hash = hasher(key) % table.size();
-        auto it = table[hash].first;
-        auto len = table[hash].second;
-        size_t i = 0;
-        while (it != lst.end() && i != len) {
-            if (it->first == key) {
-                return end();
-            }
-            ++it;
-            ++i;
+        return lst.end();
+    }
+
+    template<class K, class H = Hash, class = EnableIfTransparent<K, H> >
+    const_iterator find(const K& key) const {
+        size_t hash = hasher(key);
+        iterator it;
+        if (lookup(bucket(hash), key, hash, it)) {
+            return it;
         }
-        auto newIter = lst.insert(it, p);
-        if (table[hash].first == lst.end()) {
-            table[hash].first = newIter;
+        return lst.end();
+    }
+
+    iterator insert(const std::pair<KeyType, ValueType>& p) {
+        auto res = tryEmplace(p.first, p.second);
+        return res.second ? res.first : end();
+    }
+
+    iterator insert(std::pair<KeyType, ValueType>&& p) {
+        auto res = tryEmplace(std::move(p.first), std::move(p.second));
+        return res.second ? res.first : end();
+    }
+
+    // Builds the element in place; the arguments are consumed even if the
+    // key is already present.
+    template<class... Args>
+    std::pair<iterator, bool> emplace(Args&&... args) {
+        // The node waits at the end of lst, outside of every bucket, until
+        // its key is known to be new.
+        auto node = lst.emplace(lst.end(), std::forward<Args>(args)...);
+        size_t hash;
+        Bucket* b;
+        iterator it;
+        try {
+            hash = hasher(node->first);
+            storeHash(*node, hash);
+            prepareInsert();
+            b = &bucket(hash);
+            if (scan(*b, node->first, hash, it)) {
+                lst.erase(node);
+                return {it, false};
+            }
+        } catch (...) {
+            lst.erase(node);
+            throw;
         }
-        ++table[hash].second;
+        relink(*b, lst, node);
         ++sz;
-        return newIter;
+        return {node, true};
+    }
+
+    // Unlike emplace, leaves key and args untouched if the key is present.
+    template<class... Args>
+    std::pair<iterator, bool> try_emplace(const KeyType& key, Args&&... args) {
+        return tryEmplace(key, std::forward<Args>(args)...);
+    }
+
+    template<class... Args>
+    std::pair<iterator, bool> try_emplace(KeyType&& key, Args&&... args) {
+        return tryEmplace(std::move(key), std::forward<Args>(args)...);
     }
 
     void erase(const KeyType& key) {
-        size_t hash = hasher(key) % table.size();
-        auto it = table[hash].first;
-        auto len = table[hash].second;
-        size_t i = 0;
-        while (it != lst.end() && i != len) {
-            if (it->first == key) {
-                if (table[hash].first == it) {
-                    auto next = it;
-                    ++next;
-                    if (next != lst.end() && i + 1 < len) {
-                        table[hash].first = next;
-                    } else {
-                        table[hash].first = lst.end();
-                    }
+        eraseKey(key);
+    }
+
+    template<class K, class H = Hash, class = EnableIfTransparent<K, H> >
+    void erase(const K& key) {
+        eraseKey(key);
+    }
+
+    // Writes find(key) for every key of keys to out. Each chunk of keys is
+    // hashed and its buckets and first nodes are prefetched before any of
+    // them is scanned, so the cache misses of a chunk overlap.
+    template<class KeyRange, class OutIt>
+    OutIt find_batch(const KeyRange& keys, OutIt out) {
+        return findBatch(keys, out, [](iterator it) {
+            return it;
+        });
+    }
+
+    template<class KeyRange, class OutIt>
+    OutIt find_batch(const KeyRange& keys, OutIt out) const {
+        return const_cast<HashMap*>(this)->findBatch(keys, out, [](iterator it) {
+            return const_iterator(it);
+        });
+    }
+
+    // Inserts the pairs of range whose keys are not present yet and returns
+    // how many were inserted. The table is grown once up front and the
+    // target buckets of each chunk are prefetched like in find_batch. Each
+    // chunk is walked twice, so range needs forward iterators.
+    template<class Range>
+    size_t insert_batch(const Range& range) {
+        auto first = std::begin(range);
+        auto last = std::end(range);
+        using Category = typename std::iterator_traits<decltype(first)>::iterator_category;
+        static_assert(std::is_base_of<std::forward_iterator_tag, Category>::value,
+                      "insert_batch needs a forward range");
+        reserve(sz + std::distance(first, last));
+        size_t inserted = 0;
+        size_t hashes[BATCHSIZE];
+        while (first != last) {
+            auto chunk = first;
+            size_t n = 0;
+            for (; first != last && n != BATCHSIZE; ++first, ++n) {
+                hashes[n] = hasher(first->first);
+                prefetch(&bucket(hashes[n]));
+            }
+            for (size_t i = 0; i != n; ++i) {
+                const Bucket& b = bucket(hashes[i]);
+                if (b.second != 0) {
+                    prefetch(&*b.first);
                 }
-                lst.erase(it);
-                --table[hash].second;
-                --sz;
-                return;
             }
-            ++it;
-            ++i;
+            for (size_t i = 0; i != n; ++i, ++chunk) {
+                inserted += tryEmplaceHashed(hashes[i], chunk->first, chunk->second).second;
+            }
         }
-        return;
+        return inserted;
     }
 
     iterator begin() {
@@ -181,14 +503,29 @@ public:
     }
 
     ValueType& operator[] (const KeyType& key) {
+        return tryEmplace(key).first->second;
+    }
+
+    ValueType& operator[] (KeyType&& key) {
+        return tryEmplace(std::move(key)).first->second;
+    }
+
+    // KeyType is only built from key when the key is not there yet.
+    template<class K, class H = Hash, class = EnableIfTransparent<K, H> >
+    ValueType& operator[] (const K& key) {
+        return tryEmplace(key).first->second;
+    }
+
+    const ValueType& at(const KeyType& key) const {
         auto it = find(key);
         if (it == end()) {
-            return insert({key, ValueType()})->second;
+            throw std::out_of_range("");
         }
         return it->second;
     }
 
-    const ValueType& at(const KeyType& key) const {
+    template<class K, class H = Hash, class = EnableIfTransparent<K, H> >
+    const ValueType& at(const K& key) const {
         auto it = find(key);
         if (it == end()) {
             throw std::out_of_range("");
@@ -198,20 +535,367 @@ public:
 
     void clear() {
         table.assign(TABLESIZE, {lst.end(), 0});
+        oldTable.clear();
+        migrated = 0;
         lst.clear();
         sz = 0;
     }
 
     void swap(HashMap& other) {
-        std::swap(table, other.table);
+        table.swap(other.table);
+        oldTable.swap(other.oldTable);
+        std::swap(migrated, other.migrated);
         std::swap(lst, other.lst);
         std::swap(sz, other.sz);
         std::swap(hasher, other.hasher);
+        std::swap(equal, other.equal);
+        std::swap(maxLoad, other.maxLoad);
+        std::swap(counters, other.counters);
+    }
+
+    // Snapshot of the counters plus the current bucket-length histogram.
+    // Walks every bucket, so it is O(bucket_count()).
+    HashMapStats stats() const {
+        HashMapStats res;
+        counters.fill(res);
+        auto count = [&res](const Bucket& b) {
+            if (res.bucketLengths.size() <= b.second) {
+                res.bucketLengths.resize(b.second + 1);
+            }
+            ++res.bucketLengths[b.second];
+        };
+        if (oldTable.empty()) {
+            for (size_t i = 0; i != table.size(); ++i) {
+                count(table[i]);
+            }
+        } else {
+            for (size_t i = 0; i != migrated; ++i) {
+                count(table[i]);
+                count(table[i + oldTable.size()]);
+            }
+            for (size_t i = migrated; i != oldTable.size(); ++i) {
+                count(oldTable[i]);
+            }
+        }
+        return res;
+    }
+
+    void reset_stats() {
+        counters = Stats();
     }
 
 private:
-    std::list<std::pair<const KeyType, ValueType>> lst;
+    // First element of the bucket's run in lst and the run's length. The
+    // iterator of an empty bucket is never dereferenced.
+    using Bucket = std::pair<iterator, size_t>;
+
+    // While the table grows, buckets of oldTable below migrated have been
+    // moved to table and the rest still own their elements.
+    const Bucket& bucket(size_t hash) const {
+        if (!oldTable.empty() && (hash & (oldTable.size() - 1)) >= migrated) {
+            return oldTable[hash & (oldTable.size() - 1)];
+        }
+        return table[hash & (table.size() - 1)];
+    }
+
+    // Bucket storage that is left uninitialized by the size-only
+    // constructor. A grown table's buckets are initialized by migrateStep
+    // right before they can be reached, so starting a rehash does not touch
+    // the whole new array at once.
+    class BucketArray {
+    public:
+        BucketArray() : data(nullptr), n(0) {}
+
+        explicit BucketArray(size_t size)
+        : data(static_cast<Bucket*>(operator new(size * sizeof(Bucket))))
+        , n(size) {}
+
+        BucketArray(size_t size, const Bucket& b) : BucketArray(size) {
+            for (size_t i = 0; i != n; ++i) {
+                initialize(i, b);
+            }
+        }
+
+        BucketArray(const BucketArray&) = delete;
+
+        BucketArray& operator=(const BucketArray&) = delete;
+
+        ~BucketArray() {
+            operator delete(data);
+        }
+
+        void initialize(size_t i, const Bucket& b) {
+            new (data + i) Bucket(b);
+        }
+
+        void assign(size_t size, const Bucket& b) {
+            BucketArray(size, b).swap(*this);
+        }
+
+        void clear() {
+            BucketArray().swap(*this);
+        }
+
+        void swap(BucketArray& other) {
+            std::swap(data, other.data);
+            std::swap(n, other.n);
+        }
+
+        size_t size() const {
+            return n;
+        }
+
+        bool empty() const {
+            return n == 0;
+        }
+
+        Bucket& operator[] (size_t i) {
+            return data[i];
+        }
+
+        const Bucket& operator[] (size_t i) const {
+            return data[i];
+        }
+
+    private:
+        Bucket* data;
+        size_t n;
+    };
+
+    Bucket& bucket(size_t hash) {
+        return const_cast<Bucket&>(static_cast<const HashMap*>(this)->bucket(hash));
+    }
+
+    size_t bucketsFor(size_t n) const {
+        return static_cast<size_t>(std::ceil(static_cast<double>(n) / maxLoad));
+    }
+
+    size_t hashOf(const Entry& e) const {
+        if constexpr (CacheHash) {
+            return e.hash;
+        } else {
+            return hasher(e.first);
+        }
+    }
+
+    static void storeHash(Entry& e, size_t hash) {
+        if constexpr (CacheHash) {
+            e.hash = hash;
+        }
+    }
+
+    static bool sameHash(const Entry& e, size_t hash) {
+        if constexpr (CacheHash) {
+            return e.hash == hash;
+        }
+        return true;
+    }
+
+    // Sets it to the element of bucket b with the given key, if any.
+    template<class K>
+    bool scan(const Bucket& b, const K& key, size_t hash, iterator& it) const {
+        it = b.first;
+        for (size_t i = 0; i != b.second; ++i, ++it) {
+            if (sameHash(*it, hash) && equal(it->first, key)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Adds its lifetime to the rehash time; reads no clock without stats.
+    struct RehashTimer {
+        explicit RehashTimer(Stats& stats)
+        : stats(stats) {
+            if constexpr (Stats::enabled) {
+                start = std::chrono::steady_clock::now();
+            }
+        }
+
+        ~RehashTimer() {
+            if constexpr (Stats::enabled) {
+                stats.addRehashTime(std::chrono::steady_clock::now() - start);
+            }
+        }
+
+        Stats& stats;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    // scan for find and find_batch, counted when Stats is enabled.
+    template<class K>
+    bool lookup(const Bucket& b, const K& key, size_t hash, iterator& it) const {
+        if constexpr (Stats::enabled) {
+            it = b.first;
+            for (size_t i = 0; i != b.second; ++i, ++it) {
+                if (sameHash(*it, hash) && equal(it->first, key)) {
+                    counters.addFind(i + 1, true);
+                    return true;
+                }
+            }
+            counters.addFind(b.second, false);
+            return false;
+        }
+        return scan(b, key, hash, it);
+    }
+
+    // Starts moving the elements into a table twice as large. The elements
+    // are relinked bucket by bucket in migrateStep, so no single insert
+    // pays for the whole rehash.
+    void grow() {
+        while (!oldTable.empty()) {
+            migrateStep();
+        }
+        RehashTimer timer(counters);
+        counters.addRehash();
+        oldTable.swap(table);
+        BucketArray(oldTable.size() * 2).swap(table);
+        migrated = 0;
+    }
+
+    // Puts node of list from at the front of bucket b.
+    void relink(Bucket& b, EntryList& from, iterator node) {
+        lst.splice(b.second == 0 ? lst.end() : b.first, from, node);
+        b.first = node;
+        ++b.second;
+    }
+
+    static void prefetch(const void* p) {
+#if defined(__GNUC__)
+        __builtin_prefetch(p);
+#else
+        (void)p;
+#endif
+    }
+
+    template<class KeyRange, class OutIt, class Convert>
+    OutIt findBatch(const KeyRange& keys, OutIt out, Convert convert) {
+        auto first = std::begin(keys);
+        auto last = std::end(keys);
+        using Category = typename std::iterator_traits<decltype(first)>::iterator_category;
+        static_assert(std::is_base_of<std::forward_iterator_tag, Category>::value,
+                      "find_batch needs a forward range");
+        size_t hashes[BATCHSIZE];
+        const Bucket* buckets[BATCHSIZE];
+        while (first != last) {
+            auto chunk = first;
+            size_t n = 0;
+            for (; first != last && n != BATCHSIZE; ++first, ++n) {
+                hashes[n] = hasher(*first);
+                buckets[n] = &bucket(hashes[n]);
+                prefetch(buckets[n]);
+            }
+            for (size_t i = 0; i != n; ++i) {
+                if (buckets[i]->second != 0) {
+                    prefetch(&*buckets[i]->first);
+                }
+            }
+            for (size_t i = 0; i != n; ++i, ++chunk) {
+                iterator it;
+                if (!lookup(*buckets[i], *chunk, hashes[i], it)) {
+                    it = lst.end();
+                }
+                *out = convert(it);
+                ++out;
+            }
+        }
+        return out;
+    }
+
+    void prepareInsert() {
+        migrateStep();
+        if (sz > table.size() * maxLoad) {
+            grow();
+        }
+    }
+
+    template<class K, class... Args>
+    std::pair<iterator, bool> tryEmplace(K&& key, Args&&... args) {
+        size_t hash = hasher(key);
+        return tryEmplaceHashed(hash, std::forward<K>(key), std::forward<Args>(args)...);
+    }
+
+    template<class K, class... Args>
+    std::pair<iterator, bool> tryEmplaceHashed(size_t hash, K&& key, Args&&... args) {
+        prepareInsert();
+        Bucket& b = bucket(hash);
+        iterator it;
+        if (scan(b, key, hash, it)) {
+            return {it, false};
+        }
+        it = lst.emplace(lst.end(), std::piecewise_construct,
+                         std::forward_as_tuple(std::forward<K>(key)),
+                         std::forward_as_tuple(std::forward<Args>(args)...));
+        storeHash(*it, hash);
+        relink(b, lst, it);
+        ++sz;
+        return {it, true};
+    }
+
+    template<class K>
+    void eraseKey(const K& key) {
+        migrateStep();
+        size_t hash = hasher(key);
+        Bucket& b = bucket(hash);
+        auto it = b.first;
+        auto len = b.second;
+        size_t i = 0;
+        while (i != len) {
+            if (sameHash(*it, hash) && equal(it->first, key)) {
+                if (b.first == it) {
+                    auto next = it;
+                    ++next;
+                    if (i + 1 < len) {
+                        b.first = next;
+                    } else {
+                        b.first = lst.end();
+                    }
+                }
+                lst.erase(it);
+                --b.second;
+                --sz;
+                return;
+            }
+            ++it;
+            ++i;
+        }
+        return;
+    }
+
+    void migrateStep() {
+        if (oldTable.empty()) {
+            return;
+        }
+        RehashTimer timer(counters);
+        // A grown table takes about oldTable.size() * maxLoad inserts to
+        // fill up again, and the migration has to be over by then.
+        size_t steps = std::max(REHASHSTEP, static_cast<size_t>(std::ceil(1 / maxLoad)) + 1);
+        for (size_t step = 0; step != steps && !oldTable.empty(); ++step) {
+            Bucket& old = oldTable[migrated];
+            table.initialize(migrated, {lst.end(), 0});
+            table.initialize(migrated + oldTable.size(), {lst.end(), 0});
+            auto it = old.first;
+            for (size_t i = 0; i != old.second; ++i) {
+                auto next = it;
+                ++next;
+                relink(table[hashOf(*it) & (table.size() - 1)], lst, it);
+                it = next;
+            }
+            if (++migrated == oldTable.size()) {
+                oldTable.clear();
+                migrated = 0;
+            }
+        }
+    }
+
+    EntryList lst;
     size_t sz;
-    std::vector<std::pair<iterator, size_t>> table;
+    BucketArray table;
+    BucketArray oldTable;
+    size_t migrated;
+    float maxLoad;
     Hash hasher;
+    KeyEqual equal;
+    // Takes no room with HashMapNoStats.
+    [[no_unique_address]] mutable Stats counters;
 };
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "myVector.h"
+
+
+// Start of a MappedVector file; the elements follow at offset DATAOFFSET.
+struct MappedVectorHeader {
+    static constexpr size_t DATAOFFSET = 64;
+
+    char magic[8];
+    uint64_t elemSize;
+    uint64_t size;
+};
+
+inline const char* mappedVectorMagic() {
+    return "MAPVEC1";
+}
+
+
+// Vector whose elements live in a file mapped into memory. Reopening the
+// file gives back the elements without reading or copying them, and the
+// data can be larger than RAM as the kernel pages it in and out. reserve
+// grows the file; the size is kept in the file header, so changes reach
+// the file without any extra step, and flush() waits until they are on
+// disk. Like in Vector, growing invalidates pointers to the elements.
+template <class T>
+class MappedVector {
+    static_assert(std::is_trivially_copyable<T>::value, "elements are stored as raw bytes");
+    static_assert(alignof(T) <= MappedVectorHeader::DATAOFFSET, "element alignment too large");
+
+public:
+    enum class Advice {
+        Normal,
+        Sequential,
+        Random,
+        WillNeed
+    };
+
+    // Opens path, creating an empty vector if the file does not exist.
+    explicit MappedVector(const std::string& path)
+    : fd(-1)
+    , base(nullptr)
+    , length(0)
+    , cp(0) {
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+            throw std::runtime_error("cannot open " + path);
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::runtime_error("cannot stat " + path);
+        }
+        try {
+            if (st.st_size == 0) {
+                remap(MappedVectorHeader::DATAOFFSET);
+                std::memcpy(header()->magic, mappedVectorMagic(), sizeof(header()->magic));
+                header()->elemSize = sizeof(T);
+                header()->size = 0;
+            } else {
+                if (static_cast<size_t>(st.st_size) < MappedVectorHeader::DATAOFFSET) {
+                    throw std::runtime_error("not a mapped vector: " + path);
+                }
+                remap(st.st_size);
+                if (std::memcmp(header()->magic, mappedVectorMagic(), sizeof(header()->magic)) != 0
+                        || header()->elemSize != sizeof(T)
+                        || header()->size > cp) {
+                    throw std::runtime_error("not a mapped vector of this type: " + path);
+                }
+            }
+        } catch (...) {
+            unmap();
+            ::close(fd);
+            throw;
+        }
+    }
+
+    MappedVector(const MappedVector&) = delete;
+
+    MappedVector& operator=(const MappedVector&) = delete;
+
+    ~MappedVector() {
+        unmap();
+        ::close(fd);
+    }
+
+    size_t size() const {
+        return header()->size;
+    }
+
+    size_t capacity() const {
+        return cp;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    void reserve(size_t n) {
+        if (cp >= n) {
+            return;
+        }
+        remap(MappedVectorHeader::DATAOFFSET + n * sizeof(T));
+    }
+
+    // New elements are value-initialized.
+    void resize(size_t count) {
+        if (count > cp) {
+            reserve(std::max(count, vectorGrownCapacity<T>(cp)));
+        }
+        for (size_t i = size(); i < count; ++i) {
+            new (data() + i) T();
+        }
+        header()->size = count;
+    }
+
+    void clear() {
+        header()->size = 0;
+    }
+
+    void push_back(const T& val) {
+        size_t sz = size();
+        if (sz == cp) {
+            T copy = val;
+            reserve(vectorGrownCapacity<T>(cp));
+            new (data() + sz) T(copy);
+        } else {
+            new (data() + sz) T(val);
+        }
+        header()->size = sz + 1;
+    }
+
+    void pop_back() {
+        --header()->size;
+    }
+
+    // Writes the changed pages back and waits for them to reach the disk.
+    void flush() {
+        if (::msync(base, length, MS_SYNC) != 0) {
+            throw std::runtime_error("cannot flush mapped vector");
+        }
+    }
+
+    // Tells the kernel how the elements are about to be read, to tune
+    // readahead.
+    void advise(Advice advice) {
+        int flag = MADV_NORMAL;
+        switch (advice) {
+        case Advice::Normal:
+            flag = MADV_NORMAL;
+            break;
+        case Advice::Sequential:
+            flag = MADV_SEQUENTIAL;
+            break;
+        case Advice::Random:
+            flag = MADV_RANDOM;
+            break;
+        case Advice::WillNeed:
+            flag = MADV_WILLNEED;
+            break;
+        }
+        ::madvise(base, length, flag);
+    }
+
+    T* begin() {
+        return data();
+    }
+
+    T* end() {
+        return data() + size();
+    }
+
+    const T* begin() const {
+        return data();
+    }
+
+    const T* end() const {
+        return data() + size();
+    }
+
+    T& operator[] (size_t index) {
+        return data()[index];
+    }
+
+    const T& operator[] (size_t index) const {
+        return data()[index];
+    }
+
+private:
+    MappedVectorHeader* header() const {
+        return static_cast<MappedVectorHeader*>(base);
+    }
+
+    T* data() const {
+        return reinterpret_cast<T*>(static_cast<char*>(base) + MappedVectorHeader::DATAOFFSET);
+    }
+
+    // Sets the file to newLength bytes and maps all of it.
+    void remap(size_t newLength) {
+        if (newLength != length && ::ftruncate(fd, newLength) != 0) {
+            throw std::runtime_error("cannot resize mapped vector");
+        }
+        void* res = ::mmap(nullptr, newLength, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (res == MAP_FAILED) {
+            throw std::runtime_error("cannot map mapped vector");
+        }
+        unmap();
+        base = res;
+        length = newLength;
+        cp = (length - MappedVectorHeader::DATAOFFSET) / sizeof(T);
+    }
+
+    void unmap() {
+        if (base != nullptr) {
+            ::munmap(base, length);
+            base = nullptr;
+        }
+    }
+
+    int fd;
+    void* base;
+    size_t length;
+    size_t cp;
+};
@@ -1,7 +1,17 @@
+#pragma once
+
 #include <algorithm>
 #include <iostream>
+#include <stdexcept>
+#include <type_traits>
 #include <vector>
 
+#include "matrixExpression.h"
+#include "matrixKernels.h"
+
+template <typename T>
+class MatrixLU;
+
 template  <typename T>
 class Matrix {
 private:
@@ -38,10 +48,19 @@ public:
         std::copy(x.v.begin(), x.v.end(), v.begin());
     }
 
-    explicit Matrix(const Matrix&& that) {
+    Matrix(Matrix&& that) {
         n = that.size().first;
         m = that.size().second;
         v = std::move(that.v);
+        that.n = that.m = 0;
+    }
+
+    // Evaluates an expression such as a + b * 2 in one pass.
+    template <typename E>
+    Matrix(const MatrixExpression<E>& e)
+    : n(e.size().first)
+    , m(e.size().second) {
+        assign(e.self());
     }
 
     const T& at(const size_t i, const size_t j) const {
@@ -61,40 +80,60 @@ public:
         return {n, m};
     }
 
+    T* data() {
+        return v.data();
+    }
+
+    const T* data() const {
+        return v.data();
+    }
+
+    // Operators run on MatrixExecution::current().
     Matrix<T>& operator+= (const Matrix<T>& a) {
-        for (size_t i = 0; i != n; ++i) {
-            for (size_t j = 0; j != m; ++j) {
-                this->v[m * i + j] += a.at(i, j);
-            }
+        return *this += MatrixLeaf<T>(a);
+    }
+
+    template <typename E>
+    Matrix<T>& operator+= (const MatrixExpression<E>& e) {
+        if (e.size() != size()) {
+            throw std::out_of_range("matrix sizes differ");
         }
+        T* dst = v.data();
+        const E& src = e.self();
+        MatrixExecution::current().forRanges(n * m, 1, [dst, &src](size_t from, size_t to) {
+            for (size_t i = from; i != to; ++i) {
+                dst[i] += src[i];
+            }
+        });
         return *this;
     }
 
     Matrix<T>& operator*= (const Matrix<T>& x) {
-        size_t k = x.size().second;
-        Matrix<T> res(n, k, 0);
-
-        for (size_t t = 0; t != m; ++t) {
-            for (size_t i = 0; i != n; ++i) {
-                for (size_t j = 0; j != k; ++j) {
-                    res.add(i, j, this->at(i, t) * x.at(t, j));
-                }
-            }
-        }
-        *this = std::move(res);
+        *this = product(x);
         return *this;
     }
 
-    template <typename N>
+    template <typename N, typename std::enable_if<!IsMatrixOperand<N>::value, int>::type = 0>
     Matrix<T>& operator*= (const N& x) {
-        for (size_t i = 0; i != n; ++i) {
-            for (size_t j = 0; j != m; ++j) {
-                this->v[m * i + j] *= x;
+        T* dst = v.data();
+        MatrixExecution::current().forRanges(n * m, 1, [dst, &x](size_t from, size_t to) {
+            for (size_t i = from; i != to; ++i) {
+                dst[i] *= x;
             }
-        }
+        });
         return *this;
     }
 
+    Matrix<T> product(const Matrix<T>& x, const MatrixExecution& ex = MatrixExecution::current()) const {
+        if (x.size().first != m) {
+            throw std::out_of_range("matrix sizes differ");
+        }
+        size_t k = x.size().second;
+        Matrix<T> res(n, k, 0);
+        gemm(n, m, k, v.data(), m, x.v.data(), k, res.v.data(), k, ex);
+        return res;
+    }
+
     Matrix<T>& operator= (const Matrix<T>& x) {
         this->n = x.size().first;
         this->m = x.size().second;
@@ -103,24 +142,39 @@ public:
         return *this;
     }
 
-    Matrix<T> transposed() const {
-        Matrix<T> tmp(this->m, this->n, 0);
-        for (size_t i = 0; i != n; ++i) {
-            for (size_t j = 0; j != m; ++j) {
-                tmp.v[j * n + i] = this->at(i, j);
-            }
+    Matrix<T>& operator= (Matrix<T>&& x) {
+        if (this != &x) {
+            this->n = x.size().first;
+            this->m = x.size().second;
+            v = std::move(x.v);
+            x.n = x.m = 0;
         }
-        return tmp;
+        return *this;
+    }
+
+    // Writes straight into this matrix: every element depends only on the
+    // same element of the operands, so this may be one of them.
+    template <typename E>
+    Matrix<T>& operator= (const MatrixExpression<E>& e) {
+        n = e.size().first;
+        m = e.size().second;
+        assign(e.self());
+        return *this;
     }
 
-    Matrix<T>& transpose() {
+    Matrix<T> transposed(const MatrixExecution& ex = MatrixExecution::current()) const {
         Matrix<T> tmp(this->m, this->n, 0);
-        for (size_t i = 0; i != n; ++i) {
-            for (size_t j = 0; j != m; ++j) {
-                tmp.v[j * n + i] = this->at(i, j);
-            }
+        transposeCopy(n, m, v.data(), m, tmp.v.data(), n, ex);
+        return tmp;
+    }
+
+    // Square matrices are transposed in place, without a second buffer.
+    Matrix<T>& transpose(const MatrixExecution& ex = MatrixExecution::current()) {
+        if (n == m) {
+            transposeInPlace(n, v.data(), m, ex);
+        } else {
+            *this = transposed(ex);
         }
-        *this = std::move(tmp);
         return *this;
     }
 
@@ -177,79 +231,193 @@ public:
                        });
     }
 
+    // P this = L U; see MatrixLU.
+    MatrixLU<T> factorize(const MatrixExecution& ex = MatrixExecution::current()) const {
+        return MatrixLU<T>(*this, ex);
+    }
+
+    // Solves this x = b in U arithmetic. To solve against many right-hand
+    // sides, factorize() once and reuse the factors.
     template <typename U>
-    std::vector<U> solve(std::vector<U> b) const {
-        Matrix<U> a(n, m, this->v);
-
-        for (size_t col = 0; col != m; ++col) {
-            U mx = 0;
-            size_t mx_ind = 0;
-            for (size_t row = col; row != n; ++row) {
-                if (a.at(row, col) > mx) {
-                    mx = a.at(row, col);
-                    mx_ind = row;
-                } else if (-a.at(row, col) > mx) {
-                    mx = -a.at(row, col);
-                    mx_ind = row;
-                }
+    std::vector<U> solve(std::vector<U> b, const MatrixExecution& ex = MatrixExecution::current()) const {
+        return MatrixLU<U>(Matrix<U>(n, m, this->v), ex).solve(std::move(b));
+    }
+
+private:
+    // Makes v the n * m elements of e. On this thread they are built
+    // straight into v, with no zero fill before; the pool's workers can only
+    // write elements that exist, so a parallel evaluation sizes v first. v
+    // has another size than e only if this matrix is none of e's operands,
+    // so rebuilding it cannot clobber an input.
+    template <typename E>
+    void assign(const E& e) {
+        MatrixExecution ex = MatrixExecution::current();
+        if (v.size() != n * m && ex.parts(n * m, 1) <= 1) {
+            v.assign(MatrixExpressionIterator<E>(e, 0), MatrixExpressionIterator<E>(e, n * m));
+            return;
+        }
+        v.resize(n * m);
+        T* dst = v.data();
+        ex.forRanges(n * m, 1, [dst, &e](size_t from, size_t to) {
+            for (size_t i = from; i != to; ++i) {
+                dst[i] = e[i];
             }
+        });
+    }
+};
 
-            if (mx == 0) {
-                continue;
+// LU factorization with partial pivoting of a square matrix: P A = L U,
+// with L unit lower triangular and U upper triangular, both kept in one
+// matrix. Factorizing costs O(n^3) once; every solve after it is O(n^2)
+// per right-hand side, and a block of right-hand sides is solved with
+// gemm-based triangular solves. A singular matrix still factorizes, but
+// solve() and inverse() throw std::runtime_error on it.
+template <typename T>
+class MatrixLU {
+public:
+    explicit MatrixLU(Matrix<T> a, const MatrixExecution& ex = MatrixExecution::current())
+    : lu(std::move(a))
+    , perm(lu.size().first)
+    , swaps(0)
+    , zeroPivot(false) {
+        size_t n = lu.size().first;
+        if (lu.size().second != n) {
+            throw std::out_of_range("LU needs a square matrix");
+        }
+        swaps = luFactorize(n, lu.data(), n, perm.data(), ex);
+        for (size_t i = 0; i != n; ++i) {
+            if (lu.at(i, i) == T(0)) {
+                zeroPivot = true;
             }
+        }
+    }
+
+    size_t size() const {
+        return perm.size();
+    }
 
-            a.swap_rows(col, mx_ind);
-            std::swap(b[col], b[mx_ind]);
-
-            mx = a.at(col, col);
-            b[col] /= mx;
-            a.apply_row(col, [mx](const U& t){
-                return t / mx;
-            });
-
-            for (size_t row = 0; row != n; ++row) {
-                if (row == col) {
-                    continue;
-                }
-                b[row] -= b[col] * a.at(row, col);
-                a.row_diff(row, col, a.at(row, col));
+    bool singular() const {
+        return zeroPivot;
+    }
+
+    // L below the diagonal, U on and above it.
+    const Matrix<T>& factors() const {
+        return lu;
+    }
+
+    // Row i of L U is row permutation()[i] of A.
+    const std::vector<size_t>& permutation() const {
+        return perm;
+    }
+
+    std::vector<T> solve(const std::vector<T>& b) const {
+        size_t n = size();
+        if (b.size() != n) {
+            throw std::out_of_range("right-hand side size differs");
+        }
+        checkRegular();
+        const T* a = lu.data();
+        std::vector<T> x(n);
+        for (size_t i = 0; i != n; ++i) {
+            T acc = b[perm[i]];
+            for (size_t p = 0; p != i; ++p) {
+                acc -= a[i * n + p] * x[p];
             }
+            x[i] = acc;
         }
+        for (size_t i = n; i-- > 0;) {
+            T acc = x[i];
+            for (size_t p = i + 1; p != n; ++p) {
+                acc -= a[i * n + p] * x[p];
+            }
+            x[i] = acc / a[i * n + i];
+        }
+        return x;
+    }
 
-        return b;
+    // Solves A X = B for every column of B at once.
+    Matrix<T> solve(const Matrix<T>& b, const MatrixExecution& ex = MatrixExecution::current()) const {
+        size_t n = size();
+        size_t k = b.size().second;
+        if (b.size().first != n) {
+            throw std::out_of_range("right-hand side size differs");
+        }
+        checkRegular();
+        Matrix<T> x(n, k, 0);
+        for (size_t i = 0; i != n; ++i) {
+            std::copy(b.data() + perm[i] * k, b.data() + (perm[i] + 1) * k, x.data() + i * k);
+        }
+        trsmLowerUnit(n, k, lu.data(), n, x.data(), k, ex);
+        trsmUpper(n, k, lu.data(), n, x.data(), k, ex);
+        return x;
+    }
+
+    T determinant() const {
+        T det = swaps % 2 == 0 ? T(1) : T(-1);
+        for (size_t i = 0; i != size(); ++i) {
+            det *= lu.at(i, i);
+        }
+        return det;
+    }
+
+    Matrix<T> inverse(const MatrixExecution& ex = MatrixExecution::current()) const {
+        Matrix<T> id(size(), size(), 0);
+        for (size_t i = 0; i != size(); ++i) {
+            id.set(i, i, T(1));
+        }
+        return solve(id, ex);
+    }
+
+private:
+    void checkRegular() const {
+        if (zeroPivot) {
+            throw std::runtime_error("singular matrix");
+        }
     }
+
+    Matrix<T> lu;
+    std::vector<size_t> perm;
+    size_t swaps;
+    bool zeroPivot;
 };
 
 template <typename T>
-Matrix<T> operator+ (const Matrix<T>& a) {
-    return a * 1;
+const Matrix<T>& evaluated(const Matrix<T>& a) {
+    return a;
 }
 
-template <typename T>
-Matrix<T> operator- (const Matrix<T>& a) {
-    return a * (-1);
+template <typename E>
+Matrix<typename E::value_type> evaluated(const MatrixExpression<E>& e) {
+    return Matrix<typename E::value_type>(e);
 }
 
-template <typename T>
-Matrix<T> operator+ (const Matrix<T>& a, const Matrix<T>& b) {
-    Matrix<T> result(a.size().first, a.size().second, 0);
-    result += a;
-    result += b;
-    return result;
+template <typename A, typename std::enable_if<IsMatrixOperand<A>::value, int>::type = 0>
+MatrixNode<A> operator+ (const A& a) {
+    return matrixNode(a);
 }
 
-template <typename T>
-Matrix<T> operator* (const Matrix<T>& a, const Matrix<T>& b) {
-    Matrix<T> result(a);
-    result *= b;
-    return result;
+template <typename A, typename std::enable_if<IsMatrixOperand<A>::value, int>::type = 0>
+MatrixScaled<MatrixNode<A>, int> operator- (const A& a) {
+    return MatrixScaled<MatrixNode<A>, int>(matrixNode(a), -1);
 }
 
-template <typename T, typename N>
-Matrix<T> operator* (const Matrix<T>& a, const N& b) {
-    Matrix<T> result(a);
-    result *= b;
-    return result;
+template <typename A, typename B,
+          typename std::enable_if<IsMatrixOperand<A>::value && IsMatrixOperand<B>::value, int>::type = 0>
+MatrixSum<MatrixNode<A>, MatrixNode<B> > operator+ (const A& a, const B& b) {
+    return MatrixSum<MatrixNode<A>, MatrixNode<B> >(matrixNode(a), matrixNode(b));
+}
+
+// Matrix product; expressions on either side are evaluated first.
+template <typename A, typename B,
+          typename std::enable_if<IsMatrixOperand<A>::value && IsMatrixOperand<B>::value, int>::type = 0>
+auto operator* (const A& a, const B& b) -> decltype(evaluated(a).product(evaluated(b))) {
+    return evaluated(a).product(evaluated(b));
+}
+
+template <typename A, typename N,
+          typename std::enable_if<IsMatrixOperand<A>::value && !IsMatrixOperand<N>::value, int>::type = 0>
+MatrixScaled<MatrixNode<A>, N> operator* (const A& a, const N& x) {
+    return MatrixScaled<MatrixNode<A>, N>(matrixNode(a), x);
 }
 
 template <typename T>
@@ -270,3 +438,7 @@ std::ostream& operator<<(std::ostream& out, const Matrix<T>& m) {
     return out;
 }
 
+template <typename E>
+std::ostream& operator<<(std::ostream& out, const MatrixExpression<E>& e) {
+    return out << evaluated(e);
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+
+// Lazy element-wise Matrix arithmetic. Binary +, unary +/- and scalar *
+// return expression nodes instead of matrices; a Matrix built or assigned
+// from a chain of them computes every element in one pass over its
+// operands, with no temporaries in between. Nodes hold matrices by
+// reference, so an expression must not outlive the matrices in it: keep
+// results in a Matrix, not in auto.
+
+template <typename T>
+class Matrix;
+
+struct MatrixExpressionTag {};
+
+// Base of the nodes; E gives value_type, size() and operator[] over the
+// row-major flat index.
+template <typename E>
+class MatrixExpression : public MatrixExpressionTag {
+public:
+    const E& self() const {
+        return static_cast<const E&>(*this);
+    }
+
+    std::pair<size_t, size_t> size() const {
+        return self().size();
+    }
+
+    auto at(size_t i, size_t j) const {
+        std::pair<size_t, size_t> sz = size();
+        if (i >= sz.first || j >= sz.second) {
+            throw std::out_of_range("matrix index out of range");
+        }
+        return self()[i * sz.second + j];
+    }
+};
+
+// Matrices and expressions over them.
+template <typename X>
+struct IsMatrixOperand : std::is_base_of<MatrixExpressionTag, X> {};
+
+template <typename T>
+struct IsMatrixOperand<Matrix<T> > : std::true_type {};
+
+
+template <typename T>
+class MatrixLeaf : public MatrixExpression<MatrixLeaf<T> > {
+public:
+    using value_type = T;
+
+    explicit MatrixLeaf(const Matrix<T>& a)
+    : p(a.data())
+    , sz(a.size()) {}
+
+    std::pair<size_t, size_t> size() const {
+        return sz;
+    }
+
+    const T& operator[] (size_t i) const {
+        return p[i];
+    }
+
+private:
+    const T* p;
+    std::pair<size_t, size_t> sz;
+};
+
+template <typename L, typename R>
+class MatrixSum : public MatrixExpression<MatrixSum<L, R> > {
+public:
+    using value_type = typename L::value_type;
+    static_assert(std::is_same<value_type, typename R::value_type>::value, "element types differ");
+
+    MatrixSum(const L& l, const R& r)
+    : l(l)
+    , r(r) {
+        if (l.size() != r.size()) {
+            throw std::out_of_range("matrix sizes differ");
+        }
+    }
+
+    std::pair<size_t, size_t> size() const {
+        return l.size();
+    }
+
+    value_type operator[] (size_t i) const {
+        return l[i] + r[i];
+    }
+
+private:
+    L l;
+    R r;
+};
+
+// Elements of e times x, computed with *= like on a Matrix.
+template <typename E, typename N>
+class MatrixScaled : public MatrixExpression<MatrixScaled<E, N> > {
+public:
+    using value_type = typename E::value_type;
+
+    MatrixScaled(const E& e, const N& x)
+    : e(e)
+    , x(x) {}
+
+    std::pair<size_t, size_t> size() const {
+        return e.size();
+    }
+
+    value_type operator[] (size_t i) const {
+        value_type res = e[i];
+        res *= x;
+        return res;
+    }
+
+private:
+    E e;
+    N x;
+};
+
+
+// Walks the elements of an expression in row-major order, computing each
+// one when dereferenced, so that a std::vector can be built from them in
+// one pass.
+template <typename E>
+class MatrixExpressionIterator {
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = typename E::value_type;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = value_type;
+
+    MatrixExpressionIterator(const E& e, size_t i)
+    : e(&e)
+    , i(i) {}
+
+    value_type operator* () const {
+        return (*e)[i];
+    }
+
+    MatrixExpressionIterator& operator++ () {
+        ++i;
+        return *this;
+    }
+
+    MatrixExpressionIterator operator++ (int) {
+        MatrixExpressionIterator res = *this;
+        ++i;
+        return res;
+    }
+
+    bool operator== (const MatrixExpressionIterator& that) const {
+        return i == that.i;
+    }
+
+    bool operator!= (const MatrixExpressionIterator& that) const {
+        return i != that.i;
+    }
+
+private:
+    const E* e;
+    size_t i;
+};
+
+
+// The node standing for a Matrix or an expression in a bigger expression.
+template <typename T>
+MatrixLeaf<T> matrixNode(const Matrix<T>& a) {
+    return MatrixLeaf<T>(a);
+}
+
+template <typename E>
+const E& matrixNode(const MatrixExpression<E>& e) {
+    return e.self();
+}
+
+template <typename X>
+using MatrixNode = typename std::decay<decltype(matrixNode(std::declval<const X&>()))>::type;
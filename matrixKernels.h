@@ -0,0 +1,654 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
+
+#include "threadPool.h"
+
+
+// Where Matrix operations run: seq() keeps them on the calling thread and
+// par() splits them across a pool, the calling thread included. Operators
+// and calls without a policy use current(), which is the shared pool
+// unless setThreads() picked another thread count.
+class MatrixExecution {
+public:
+    static MatrixExecution seq() {
+        return MatrixExecution(nullptr);
+    }
+
+    static MatrixExecution par(ThreadPool& pool = ThreadPool::instance()) {
+        return MatrixExecution(&pool);
+    }
+
+    static MatrixExecution current() {
+        ThreadPool* pool = currentPool();
+        return MatrixExecution(pool != nullptr && pool->size() > 1 ? pool : nullptr);
+    }
+
+    // Runs later operations on threads threads, the caller included; 1
+    // makes them sequential. Not to be called while operations are running.
+    static void setThreads(size_t threads) {
+        ownedPool().reset(threads > 1 ? new ThreadPool(threads) : nullptr);
+        currentPool() = ownedPool().get();
+    }
+
+    size_t threads() const {
+        return pool != nullptr ? pool->size() : 1;
+    }
+
+    // Number of ranges forRanges(count, cost, ...) splits the work into;
+    // 1 means it runs on the calling thread.
+    size_t parts(size_t count, size_t cost) const {
+        return ThreadPoolSplit(count, threads(), cost).count();
+    }
+
+    // Calls fn(begin, end) for the ranges of ThreadPoolSplit covering
+    // [0, count), where each index costs about cost elements of work.
+    template <class F>
+    void forRanges(size_t count, size_t cost, F fn) const {
+        ThreadPoolSplit split(count, threads(), cost);
+        if (split.count() == 1) {
+            fn(size_t(0), count);
+            return;
+        }
+        pool->run(split.count(), [&](size_t i) {
+            fn(split.begin(i), split.end(i));
+        });
+    }
+
+    // Calls fn(i) for every i in [0, tasks).
+    template <class F>
+    void run(size_t tasks, F fn) const {
+        if (pool == nullptr || tasks <= 1) {
+            for (size_t i = 0; i != tasks; ++i) {
+                fn(i);
+            }
+        } else {
+            pool->run(tasks, fn);
+        }
+    }
+
+private:
+    explicit MatrixExecution(ThreadPool* pool)
+    : pool(pool) {}
+
+    static ThreadPool*& currentPool() {
+        static ThreadPool* pool = &ThreadPool::instance();
+        return pool;
+    }
+
+    static std::unique_ptr<ThreadPool>& ownedPool() {
+        static std::unique_ptr<ThreadPool> pool;
+        return pool;
+    }
+
+    ThreadPool* pool;
+};
+
+
+// Matrix product kernels. gemm follows the usual BLIS layout: B is packed
+// into KC x NR column panels that stay in L2/L3, A into MC x KC row panels
+// that stay in L2, and a micro-kernel keeps an MR x NR tile of C in
+// registers while it streams through one panel of each.
+
+// Fallback micro-kernel for any T with T(0), + and *.
+template <class T>
+struct GemmKernel {
+    static constexpr size_t MR = 4;
+    static constexpr size_t NR = 4;
+
+    // c[i][j] += sum over p of a[p][i] * b[p][j] for the mr x nr corner
+    // of the tile; a and b are packed panels of kc steps.
+    static void run(size_t kc, const T* a, const T* b, T* c, size_t ldc, size_t mr, size_t nr) {
+        T acc[MR][NR];
+        for (size_t i = 0; i != MR; ++i) {
+            for (size_t j = 0; j != NR; ++j) {
+                acc[i][j] = T(0);
+            }
+        }
+        for (size_t p = 0; p != kc; ++p, a += MR, b += NR) {
+            for (size_t i = 0; i != MR; ++i) {
+                for (size_t j = 0; j != NR; ++j) {
+                    acc[i][j] += a[i] * b[j];
+                }
+            }
+        }
+        for (size_t i = 0; i != mr; ++i) {
+            for (size_t j = 0; j != nr; ++j) {
+                c[i * ldc + j] += acc[i][j];
+            }
+        }
+    }
+};
+
+#if defined(__AVX2__) && defined(__FMA__)
+// 6 x 8 doubles: twelve accumulators, two B vectors and a broadcast of A
+// fill fifteen of the sixteen ymm registers.
+template <>
+struct GemmKernel<double> {
+    static constexpr size_t MR = 6;
+    static constexpr size_t NR = 8;
+
+    static void run(size_t kc, const double* a, const double* b, double* c, size_t ldc, size_t mr, size_t nr) {
+        // Named rather than an array, so they surely stay in registers.
+        __m256d c00 = _mm256_setzero_pd();
+        __m256d c01 = _mm256_setzero_pd();
+        __m256d c10 = _mm256_setzero_pd();
+        __m256d c11 = _mm256_setzero_pd();
+        __m256d c20 = _mm256_setzero_pd();
+        __m256d c21 = _mm256_setzero_pd();
+        __m256d c30 = _mm256_setzero_pd();
+        __m256d c31 = _mm256_setzero_pd();
+        __m256d c40 = _mm256_setzero_pd();
+        __m256d c41 = _mm256_setzero_pd();
+        __m256d c50 = _mm256_setzero_pd();
+        __m256d c51 = _mm256_setzero_pd();
+        for (size_t p = 0; p != kc; ++p, a += MR, b += NR) {
+            __m256d b0 = _mm256_loadu_pd(b);
+            __m256d b1 = _mm256_loadu_pd(b + 4);
+            __m256d a0;
+            a0 = _mm256_broadcast_sd(a + 0);
+            c00 = _mm256_fmadd_pd(a0, b0, c00);
+            c01 = _mm256_fmadd_pd(a0, b1, c01);
+            a0 = _mm256_broadcast_sd(a + 1);
+            c10 = _mm256_fmadd_pd(a0, b0, c10);
+            c11 = _mm256_fmadd_pd(a0, b1, c11);
+            a0 = _mm256_broadcast_sd(a + 2);
+            c20 = _mm256_fmadd_pd(a0, b0, c20);
+            c21 = _mm256_fmadd_pd(a0, b1, c21);
+            a0 = _mm256_broadcast_sd(a + 3);
+            c30 = _mm256_fmadd_pd(a0, b0, c30);
+            c31 = _mm256_fmadd_pd(a0, b1, c31);
+            a0 = _mm256_broadcast_sd(a + 4);
+            c40 = _mm256_fmadd_pd(a0, b0, c40);
+            c41 = _mm256_fmadd_pd(a0, b1, c41);
+            a0 = _mm256_broadcast_sd(a + 5);
+            c50 = _mm256_fmadd_pd(a0, b0, c50);
+            c51 = _mm256_fmadd_pd(a0, b1, c51);
+        }
+        __m256d acc[MR][2] = {{c00, c01}, {c10, c11}, {c20, c21}, {c30, c31}, {c40, c41}, {c50, c51}};
+        if (mr == MR && nr == NR) {
+            for (size_t i = 0; i != MR; ++i) {
+                double* row = c + i * ldc;
+                _mm256_storeu_pd(row, _mm256_add_pd(_mm256_loadu_pd(row), acc[i][0]));
+                _mm256_storeu_pd(row + 4, _mm256_add_pd(_mm256_loadu_pd(row + 4), acc[i][1]));
+            }
+            return;
+        }
+        double tile[MR][NR];
+        for (size_t i = 0; i != MR; ++i) {
+            _mm256_storeu_pd(tile[i], acc[i][0]);
+            _mm256_storeu_pd(tile[i] + 4, acc[i][1]);
+        }
+        for (size_t i = 0; i != mr; ++i) {
+            for (size_t j = 0; j != nr; ++j) {
+                c[i * ldc + j] += tile[i][j];
+            }
+        }
+    }
+};
+
+// 6 x 16 floats, the same register layout as for double.
+template <>
+struct GemmKernel<float> {
+    static constexpr size_t MR = 6;
+    static constexpr size_t NR = 16;
+
+    static void run(size_t kc, const float* a, const float* b, float* c, size_t ldc, size_t mr, size_t nr) {
+        // Named rather than an array, so they surely stay in registers.
+        __m256 c00 = _mm256_setzero_ps();
+        __m256 c01 = _mm256_setzero_ps();
+        __m256 c10 = _mm256_setzero_ps();
+        __m256 c11 = _mm256_setzero_ps();
+        __m256 c20 = _mm256_setzero_ps();
+        __m256 c21 = _mm256_setzero_ps();
+        __m256 c30 = _mm256_setzero_ps();
+        __m256 c31 = _mm256_setzero_ps();
+        __m256 c40 = _mm256_setzero_ps();
+        __m256 c41 = _mm256_setzero_ps();
+        __m256 c50 = _mm256_setzero_ps();
+        __m256 c51 = _mm256_setzero_ps();
+        for (size_t p = 0; p != kc; ++p, a += MR, b += NR) {
+            __m256 b0 = _mm256_loadu_ps(b);
+            __m256 b1 = _mm256_loadu_ps(b + 8);
+            __m256 a0;
+            a0 = _mm256_broadcast_ss(a + 0);
+            c00 = _mm256_fmadd_ps(a0, b0, c00);
+            c01 = _mm256_fmadd_ps(a0, b1, c01);
+            a0 = _mm256_broadcast_ss(a + 1);
+            c10 = _mm256_fmadd_ps(a0, b0, c10);
+            c11 = _mm256_fmadd_ps(a0, b1, c11);
+            a0 = _mm256_broadcast_ss(a + 2);
+            c20 = _mm256_fmadd_ps(a0, b0, c20);
+            c21 = _mm256_fmadd_ps(a0, b1, c21);
+            a0 = _mm256_broadcast_ss(a + 3);
+            c30 = _mm256_fmadd_ps(a0, b0, c30);
+            c31 = _mm256_fmadd_ps(a0, b1, c31);
+            a0 = _mm256_broadcast_ss(a + 4);
+            c40 = _mm256_fmadd_ps(a0, b0, c40);
+            c41 = _mm256_fmadd_ps(a0, b1, c41);
+            a0 = _mm256_broadcast_ss(a + 5);
+            c50 = _mm256_fmadd_ps(a0, b0, c50);
+            c51 = _mm256_fmadd_ps(a0, b1, c51);
+        }
+        __m256 acc[MR][2] = {{c00, c01}, {c10, c11}, {c20, c21}, {c30, c31}, {c40, c41}, {c50, c51}};
+        if (mr == MR && nr == NR) {
+            for (size_t i = 0; i != MR; ++i) {
+                float* row = c + i * ldc;
+                _mm256_storeu_ps(row, _mm256_add_ps(_mm256_loadu_ps(row), acc[i][0]));
+                _mm256_storeu_ps(row + 8, _mm256_add_ps(_mm256_loadu_ps(row + 8), acc[i][1]));
+            }
+            return;
+        }
+        float tile[MR][NR];
+        for (size_t i = 0; i != MR; ++i) {
+            _mm256_storeu_ps(tile[i], acc[i][0]);
+            _mm256_storeu_ps(tile[i] + 8, acc[i][1]);
+        }
+        for (size_t i = 0; i != mr; ++i) {
+            for (size_t j = 0; j != nr; ++j) {
+                c[i * ldc + j] += tile[i][j];
+            }
+        }
+    }
+};
+#endif
+
+// Transpose kernels: run copies the transpose of an S x S block of a into
+// b, which must not overlap it.
+template <class T>
+struct TransposeKernel {
+    static constexpr size_t S = 4;
+
+    static void run(const T* a, size_t lda, T* b, size_t ldb) {
+        for (size_t i = 0; i != S; ++i) {
+            for (size_t j = 0; j != S; ++j) {
+                b[j * ldb + i] = a[i * lda + j];
+            }
+        }
+    }
+};
+
+#if defined(__AVX2__) && defined(__FMA__)
+// Four rows go through registers: pairs are interleaved within lanes, then
+// the 128-bit halves are swapped across rows.
+template <>
+struct TransposeKernel<double> {
+    static constexpr size_t S = 4;
+
+    static void run(const double* a, size_t lda, double* b, size_t ldb) {
+        __m256d r0 = _mm256_loadu_pd(a);
+        __m256d r1 = _mm256_loadu_pd(a + lda);
+        __m256d r2 = _mm256_loadu_pd(a + 2 * lda);
+        __m256d r3 = _mm256_loadu_pd(a + 3 * lda);
+        __m256d t0 = _mm256_unpacklo_pd(r0, r1);
+        __m256d t1 = _mm256_unpackhi_pd(r0, r1);
+        __m256d t2 = _mm256_unpacklo_pd(r2, r3);
+        __m256d t3 = _mm256_unpackhi_pd(r2, r3);
+        _mm256_storeu_pd(b, _mm256_permute2f128_pd(t0, t2, 0x20));
+        _mm256_storeu_pd(b + ldb, _mm256_permute2f128_pd(t1, t3, 0x20));
+        _mm256_storeu_pd(b + 2 * ldb, _mm256_permute2f128_pd(t0, t2, 0x31));
+        _mm256_storeu_pd(b + 3 * ldb, _mm256_permute2f128_pd(t1, t3, 0x31));
+    }
+};
+
+// 8 x 8 floats: unpack, shuffle, then swap 128-bit halves.
+template <>
+struct TransposeKernel<float> {
+    static constexpr size_t S = 8;
+
+    static void run(const float* a, size_t lda, float* b, size_t ldb) {
+        __m256 r0 = _mm256_loadu_ps(a);
+        __m256 r1 = _mm256_loadu_ps(a + lda);
+        __m256 r2 = _mm256_loadu_ps(a + 2 * lda);
+        __m256 r3 = _mm256_loadu_ps(a + 3 * lda);
+        __m256 r4 = _mm256_loadu_ps(a + 4 * lda);
+        __m256 r5 = _mm256_loadu_ps(a + 5 * lda);
+        __m256 r6 = _mm256_loadu_ps(a + 6 * lda);
+        __m256 r7 = _mm256_loadu_ps(a + 7 * lda);
+        __m256 t0 = _mm256_unpacklo_ps(r0, r1);
+        __m256 t1 = _mm256_unpackhi_ps(r0, r1);
+        __m256 t2 = _mm256_unpacklo_ps(r2, r3);
+        __m256 t3 = _mm256_unpackhi_ps(r2, r3);
+        __m256 t4 = _mm256_unpacklo_ps(r4, r5);
+        __m256 t5 = _mm256_unpackhi_ps(r4, r5);
+        __m256 t6 = _mm256_unpacklo_ps(r6, r7);
+        __m256 t7 = _mm256_unpackhi_ps(r6, r7);
+        __m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+        __m256 s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+        __m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+        __m256 s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+        __m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+        __m256 s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+        __m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+        __m256 s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+        _mm256_storeu_ps(b, _mm256_permute2f128_ps(s0, s4, 0x20));
+        _mm256_storeu_ps(b + ldb, _mm256_permute2f128_ps(s1, s5, 0x20));
+        _mm256_storeu_ps(b + 2 * ldb, _mm256_permute2f128_ps(s2, s6, 0x20));
+        _mm256_storeu_ps(b + 3 * ldb, _mm256_permute2f128_ps(s3, s7, 0x20));
+        _mm256_storeu_ps(b + 4 * ldb, _mm256_permute2f128_ps(s0, s4, 0x31));
+        _mm256_storeu_ps(b + 5 * ldb, _mm256_permute2f128_ps(s1, s5, 0x31));
+        _mm256_storeu_ps(b + 6 * ldb, _mm256_permute2f128_ps(s2, s6, 0x31));
+        _mm256_storeu_ps(b + 7 * ldb, _mm256_permute2f128_ps(s3, s7, 0x31));
+    }
+};
+#endif
+
+// Tiles of TILE x TILE elements: the source tile and the destination tile
+// both stay in L1 while the kernel walks over them, so every cache line
+// is fetched once, not once per element.
+struct TransposeBlocking {
+    static constexpr size_t TILE = 32;
+};
+
+// Copies the transpose of the rows x cols block a into b.
+template <class T>
+void transposeTile(size_t rows, size_t cols, const T* a, size_t lda, T* b, size_t ldb) {
+    constexpr size_t S = TransposeKernel<T>::S;
+    size_t i = 0;
+    for (; i + S <= rows; i += S) {
+        size_t j = 0;
+        for (; j + S <= cols; j += S) {
+            TransposeKernel<T>::run(a + i * lda + j, lda, b + j * ldb + i, ldb);
+        }
+        for (; j != cols; ++j) {
+            for (size_t r = i; r != i + S; ++r) {
+                b[j * ldb + r] = a[r * lda + j];
+            }
+        }
+    }
+    for (; i != rows; ++i) {
+        for (size_t j = 0; j != cols; ++j) {
+            b[j * ldb + i] = a[i * lda + j];
+        }
+    }
+}
+
+// b (m x n) = transpose of a (n x m).
+template <class T>
+void transposeCopy(size_t n, size_t m, const T* a, size_t lda, T* b, size_t ldb,
+                   const MatrixExecution& ex = MatrixExecution::seq()) {
+    constexpr size_t TILE = TransposeBlocking::TILE;
+    ex.forRanges((n + TILE - 1) / TILE, TILE * m, [&](size_t from, size_t to) {
+        for (size_t ib = from * TILE; ib < std::min(n, to * TILE); ib += TILE) {
+            for (size_t jb = 0; jb < m; jb += TILE) {
+                transposeTile(std::min(TILE, n - ib), std::min(TILE, m - jb), a + ib * lda + jb, lda,
+                              b + jb * ldb + ib, ldb);
+            }
+        }
+    });
+}
+
+// Transposes the n x n block a in place. Tiles above the diagonal are
+// swapped with their mirror tiles through a TILE x TILE buffer on the
+// stack, so nothing of the size of a is allocated.
+template <class T>
+void transposeInPlace(size_t n, T* a, size_t lda, const MatrixExecution& ex = MatrixExecution::seq()) {
+    constexpr size_t TILE = TransposeBlocking::TILE;
+    size_t tiles = (n + TILE - 1) / TILE;
+    // Row of tiles ti owns the pairs (ti, tj) with tj >= ti.
+    ex.forRanges(tiles, TILE * n / 2, [&](size_t from, size_t to) {
+        T buffer[TILE * TILE];
+        for (size_t ti = from; ti != to; ++ti) {
+            size_t i0 = ti * TILE;
+            size_t rows = std::min(TILE, n - i0);
+            for (size_t tj = ti; tj != tiles; ++tj) {
+                size_t j0 = tj * TILE;
+                size_t cols = std::min(TILE, n - j0);
+                T* upper = a + i0 * lda + j0;
+                T* lower = a + j0 * lda + i0;
+                transposeTile(rows, cols, upper, lda, buffer, TILE);
+                if (tj != ti) {
+                    transposeTile(cols, rows, lower, lda, upper, lda);
+                }
+                for (size_t j = 0; j != cols; ++j) {
+                    std::copy(buffer + j * TILE, buffer + j * TILE + rows, lower + j * lda);
+                }
+            }
+        }
+    });
+}
+
+template <class T>
+struct GemmBlocking {
+    static constexpr size_t KC = 256;
+    static constexpr size_t MC = 24 * GemmKernel<T>::MR;
+    static constexpr size_t NC = 2048;
+};
+
+// Copies rows [0, mc) x columns [0, kc) of a into panels of MR rows, each
+// stored step by step; the last panel is padded with zeros.
+template <class T>
+void gemmPackA(size_t mc, size_t kc, const T* a, size_t lda, T* out) {
+    constexpr size_t MR = GemmKernel<T>::MR;
+    for (size_t i = 0; i < mc; i += MR) {
+        size_t rows = std::min(MR, mc - i);
+        for (size_t p = 0; p != kc; ++p) {
+            for (size_t r = 0; r != MR; ++r) {
+                *out++ = r < rows ? a[(i + r) * lda + p] : T(0);
+            }
+        }
+    }
+}
+
+// Copies rows [0, kc) x columns [0, nc) of b into panels of NR columns.
+template <class T>
+void gemmPackB(size_t kc, size_t nc, const T* b, size_t ldb, T* out) {
+    constexpr size_t NR = GemmKernel<T>::NR;
+    for (size_t j = 0; j < nc; j += NR) {
+        size_t cols = std::min(NR, nc - j);
+        for (size_t p = 0; p != kc; ++p) {
+            const T* row = b + p * ldb + j;
+            for (size_t r = 0; r != NR; ++r) {
+                *out++ = r < cols ? row[r] : T(0);
+            }
+        }
+    }
+}
+
+// Per thread buffer for packed panels, grown as needed and kept between
+// calls.
+template <class T>
+T* gemmBuffer(size_t count) {
+    static thread_local std::vector<T> buffer;
+    if (buffer.size() < count) {
+        buffer.resize(count);
+    }
+    return buffer.data();
+}
+
+// c += a * b for row-major a (n x m), b (m x k) and c (n x k) with row
+// strides lda, ldb and ldc. In parallel, threads pack parts of each B panel
+// and then take blocks of rows of c, packing their own A panels.
+template <class T>
+void gemm(size_t n, size_t m, size_t k, const T* a, size_t lda, const T* b, size_t ldb, T* c, size_t ldc,
+          const MatrixExecution& ex = MatrixExecution::seq()) {
+    constexpr size_t MR = GemmKernel<T>::MR;
+    constexpr size_t NR = GemmKernel<T>::NR;
+    constexpr size_t KC = GemmBlocking<T>::KC;
+    constexpr size_t MC = GemmBlocking<T>::MC;
+    constexpr size_t NC = GemmBlocking<T>::NC;
+
+    // Packing does not pay off for small products.
+    if (n * m * k <= 32 * 32 * 32) {
+        for (size_t i = 0; i != n; ++i) {
+            for (size_t p = 0; p != m; ++p) {
+                const T& aip = a[i * lda + p];
+                for (size_t j = 0; j != k; ++j) {
+                    c[i * ldc + j] += aip * b[p * ldb + j];
+                }
+            }
+        }
+        return;
+    }
+
+    // Smaller row blocks when there are too few to go around.
+    size_t threads = ex.threads();
+    size_t mcStep = std::min(MC, std::max(MR, ((n + threads - 1) / threads + MR - 1) / MR * MR));
+    size_t kcMax = std::min(KC, m);
+    std::vector<T> packedB(kcMax * ((std::min(NC, k) + NR - 1) / NR * NR));
+    for (size_t jc = 0; jc < k; jc += NC) {
+        size_t nc = std::min(NC, k - jc);
+        size_t panels = (nc + NR - 1) / NR;
+        for (size_t pc = 0; pc < m; pc += KC) {
+            size_t kc = std::min(KC, m - pc);
+            ex.forRanges(panels, kc * NR, [&](size_t from, size_t to) {
+                gemmPackB(kc, std::min(nc, to * NR) - from * NR, b + pc * ldb + jc + from * NR, ldb,
+                          packedB.data() + from * NR * kc);
+            });
+            ex.run((n + mcStep - 1) / mcStep, [&](size_t block) {
+                size_t ic = block * mcStep;
+                size_t mc = std::min(mcStep, n - ic);
+                T* packedA = gemmBuffer<T>(kcMax * ((mcStep + MR - 1) / MR * MR));
+                gemmPackA(mc, kc, a + ic * lda + pc, lda, packedA);
+                for (size_t jr = 0; jr < nc; jr += NR) {
+                    for (size_t ir = 0; ir < mc; ir += MR) {
+                        GemmKernel<T>::run(kc, packedA + ir * kc, packedB.data() + jr * kc,
+                                           c + (ic + ir) * ldc + jc + jr, ldc,
+                                           std::min(MR, mc - ir), std::min(NR, nc - jr));
+                    }
+                }
+            });
+        }
+    }
+}
+
+// c -= a * b, through gemm on a negated copy of a.
+template <class T>
+void gemmSubtract(size_t n, size_t m, size_t k, const T* a, size_t lda, const T* b, size_t ldb, T* c, size_t ldc,
+                  const MatrixExecution& ex = MatrixExecution::seq()) {
+    if (n == 0 || m == 0 || k == 0) {
+        return;
+    }
+    std::vector<T> negated(n * m);
+    for (size_t i = 0; i != n; ++i) {
+        for (size_t p = 0; p != m; ++p) {
+            negated[i * m + p] = -a[i * lda + p];
+        }
+    }
+    gemm(n, m, k, negated.data(), m, b, ldb, c, ldc, ex);
+}
+
+
+// Triangular solves with many right-hand sides: b (n x k) is overwritten
+// with the solution. Diagonal blocks of PANEL rows are solved row by row,
+// split by columns of b, and each solved block is taken off the rest of b
+// with one gemm, which does almost all of the work.
+struct TriangularBlocking {
+    static constexpr size_t PANEL = 64;
+};
+
+// l x = b, l being the unit lower triangle of an n x n block.
+template <class T>
+void trsmLowerUnit(size_t n, size_t k, const T* l, size_t ldl, T* b, size_t ldb,
+                   const MatrixExecution& ex = MatrixExecution::seq()) {
+    constexpr size_t PANEL = TriangularBlocking::PANEL;
+    for (size_t ib = 0; ib < n; ib += PANEL) {
+        size_t nb = std::min(PANEL, n - ib);
+        ex.forRanges(k, nb * nb, [&](size_t from, size_t to) {
+            for (size_t i = ib; i != ib + nb; ++i) {
+                T* row = b + i * ldb;
+                for (size_t p = ib; p != i; ++p) {
+                    const T lip = l[i * ldl + p];
+                    const T* src = b + p * ldb;
+                    for (size_t j = from; j != to; ++j) {
+                        row[j] -= lip * src[j];
+                    }
+                }
+            }
+        });
+        gemmSubtract(n - ib - nb, nb, k, l + (ib + nb) * ldl + ib, ldl, b + ib * ldb, ldb,
+                     b + (ib + nb) * ldb, ldb, ex);
+    }
+}
+
+// u x = b, u being the upper triangle of an n x n block.
+template <class T>
+void trsmUpper(size_t n, size_t k, const T* u, size_t ldu, T* b, size_t ldb,
+               const MatrixExecution& ex = MatrixExecution::seq()) {
+    constexpr size_t PANEL = TriangularBlocking::PANEL;
+    for (size_t end = n; end > 0;) {
+        size_t nb = std::min(PANEL, end);
+        size_t ib = end - nb;
+        ex.forRanges(k, nb * nb, [&](size_t from, size_t to) {
+            for (size_t i = end; i-- > ib;) {
+                T* row = b + i * ldb;
+                for (size_t p = i + 1; p != end; ++p) {
+                    const T uip = u[i * ldu + p];
+                    const T* src = b + p * ldb;
+                    for (size_t j = from; j != to; ++j) {
+                        row[j] -= uip * src[j];
+                    }
+                }
+                const T uii = u[i * ldu + i];
+                for (size_t j = from; j != to; ++j) {
+                    row[j] /= uii;
+                }
+            }
+        });
+        gemmSubtract(ib, nb, k, u + ib, ldu, b + ib * ldb, ldb, b, ldb, ex);
+        end = ib;
+    }
+}
+
+// LU factorization with partial pivoting of the n x n block a, in place:
+// the unit lower triangle of a becomes L and the upper triangle U, with
+// P a = L U. Row i of the result was row perm[i] of a. Panels of PANEL
+// columns are factorized one at a time; the rows of U to their right are
+// a triangular solve and the rest of the matrix a gemm update. A column
+// with no nonzero pivot is left as it is. Returns the number of row swaps.
+template <class T>
+size_t luFactorize(size_t n, T* a, size_t lda, size_t* perm, const MatrixExecution& ex = MatrixExecution::seq()) {
+    constexpr size_t PANEL = TriangularBlocking::PANEL;
+    size_t swaps = 0;
+    for (size_t i = 0; i != n; ++i) {
+        perm[i] = i;
+    }
+    for (size_t kb = 0; kb < n; kb += PANEL) {
+        size_t nb = std::min(PANEL, n - kb);
+        size_t panelEnd = kb + nb;
+        for (size_t j = kb; j != panelEnd; ++j) {
+            size_t pivot = j;
+            T best = a[j * lda + j] < T(0) ? -a[j * lda + j] : a[j * lda + j];
+            for (size_t i = j + 1; i != n; ++i) {
+                const T& x = a[i * lda + j];
+                if (x > best) {
+                    best = x;
+                    pivot = i;
+                } else if (-x > best) {
+                    best = -x;
+                    pivot = i;
+                }
+            }
+            if (best == T(0)) {
+                continue;
+            }
+            if (pivot != j) {
+                std::swap_ranges(a + j * lda, a + j * lda + n, a + pivot * lda);
+                std::swap(perm[j], perm[pivot]);
+                ++swaps;
+            }
+            const T* top = a + j * lda;
+            ex.forRanges(n - j - 1, panelEnd - j, [&](size_t from, size_t to) {
+                for (size_t i = j + 1 + from; i != j + 1 + to; ++i) {
+                    T* row = a + i * lda;
+                    row[j] /= top[j];
+                    for (size_t c = j + 1; c != panelEnd; ++c) {
+                        row[c] -= row[j] * top[c];
+                    }
+                }
+            });
+        }
+        size_t rest = n - panelEnd;
+        trsmLowerUnit(nb, rest, a + kb * lda + kb, lda, a + kb * lda + panelEnd, lda, ex);
+        gemmSubtract(rest, nb, rest, a + panelEnd * lda + kb, lda, a + kb * lda + panelEnd, lda,
+                     a + panelEnd * lda + panelEnd, lda, ex);
+    }
+    return swaps;
+}
@@ -1,16 +1,222 @@
+#pragma once
+
 #include <algorithm>
 #include <utility>
 #include <cstddef>
+#include <cstring>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+// A full Vector<T> multiplies its capacity by NUM / DEN. Specialize it for
+// a factor below the golden ratio, like 3 / 2, to let a grown block fit
+// into the space freed by the earlier ones.
+template <class T>
+struct VectorGrowthPolicy {
+    static constexpr size_t NUM = 2;
+    static constexpr size_t DEN = 1;
+};
+
+// Capacity after growing a full vector of capacity cp.
+template <class T>
+size_t vectorGrownCapacity(size_t cp) {
+    size_t n = cp * VectorGrowthPolicy<T>::NUM / VectorGrowthPolicy<T>::DEN;
+    return std::max(n, cp + 1);
+}
+
+// Moves n elements from the start of from to uninitialized memory at to
+// and ends their lifetime in from. Trivially copyable types are copied
+// with memcpy; others are moved if that cannot throw, copied otherwise,
+// so from is left intact when an exception escapes.
+template <class T, class Alloc>
+void relocateElements(Alloc& alloc, T * from, size_t n, T * to) {
+    using Traits = std::allocator_traits<Alloc>;
+    if constexpr (std::is_trivially_copyable<T>::value) {
+        if (n != 0) {
+            std::memcpy(static_cast<void*>(to), static_cast<const void*>(from), n * sizeof(T));
+        }
+    } else {
+        size_t i = 0;
+        try {
+            for (; i != n; ++i) {
+                Traits::construct(alloc, to + i, std::move_if_noexcept(from[i]));
+            }
+        } catch (...) {
+            for (size_t j = 0; j != i; ++j) {
+                Traits::destroy(alloc, to + j);
+            }
+            throw;
+        }
+        for (size_t j = 0; j != n; ++j) {
+            Traits::destroy(alloc, from + j);
+        }
+    }
+}
 
 template <class T>
-class Vector {
+void relocateElements(T * from, size_t n, T * to) {
+    std::allocator<T> alloc;
+    relocateElements(alloc, from, n, to);
+}
+
+// Whether Alloc has reallocate(p, oldN, newN), which resizes a block in
+// place or moves its bytes itself, like HugePageAllocator does with mremap.
+template <class Alloc, class = void>
+struct AllocatorCanReallocate : std::false_type {};
+
+template <class Alloc>
+struct AllocatorCanReallocate<Alloc, decltype(void(std::declval<Alloc&>().reallocate(
+        std::declval<typename Alloc::value_type*>(), size_t(), size_t())))> : std::true_type {};
+
+// Room for N elements inside a vector object, used before the vector
+// first allocates. Vector has none, so its empty storage starts at nullptr.
+template <class T, size_t N>
+class VectorInlineStorage {
+protected:
+    T * inlineData() {
+        return reinterpret_cast<T*>(buffer);
+    }
+
+    bool isInline(const T * p) const {
+        return p == reinterpret_cast<const T*>(buffer);
+    }
+
 private:
+    alignas(T) unsigned char buffer[N * sizeof(T)];
+};
+
+template <class T>
+class VectorInlineStorage<T, 0> {
+protected:
+    T * inlineData() {
+        return nullptr;
+    }
+
+    bool isInline(const T * p) const {
+        return p == nullptr;
+    }
+};
+
+// Element handling shared by Vector and SmallVector: growth, relocation,
+// insertion and erasure over a block from Alloc, or over the N inline
+// elements until the first allocation. Copying, moving and swapping
+// depend on where the elements are, so they are left to the derived
+// classes.
+template <class T, class Alloc, size_t N>
+class VectorBase : protected VectorInlineStorage<T, N> {
+protected:
+    using Traits = std::allocator_traits<Alloc>;
+
+    static constexpr bool REALLOCATE = std::is_trivially_copyable<T>::value
+            && AllocatorCanReallocate<Alloc>::value;
+
     T * data;
     size_t sz;
     size_t cp;
+    // Takes no room when Alloc is empty, like std::allocator.
+    [[no_unique_address]] Alloc alloc;
+
+    explicit VectorBase(const Alloc& alloc)
+    : data(this->inlineData())
+    , sz(0)
+    , cp(N)
+    , alloc(alloc) {}
+
+    VectorBase(const VectorBase&) = delete;
+
+    VectorBase& operator= (const VectorBase&) = delete;
+
+    ~VectorBase() {
+        destroy(0, sz);
+        deallocate();
+    }
+
+    size_t grown() const {
+        return vectorGrownCapacity<T>(cp);
+    }
+
+    void destroy(size_t from, size_t to) {
+        for (size_t j = from; j != to; ++j) {
+            Traits::destroy(alloc, data + j);
+        }
+    }
+
+    // Frees the block, if any, and goes back to the inline storage.
+    void deallocate() {
+        if (!this->isInline(data)) {
+            Traits::deallocate(alloc, data, cp);
+        }
+        data = this->inlineData();
+        cp = N;
+    }
+
+    // emplace_back into a full vector. The new element is built before the
+    // old ones are relocated, as args may refer to one of them.
+    template <class... Args>
+    void growAndEmplace(Args&&... args) {
+        if constexpr (REALLOCATE) {
+            T val(std::forward<Args>(args)...);
+            reserve(grown());
+            Traits::construct(alloc, data + sz, val);
+            ++sz;
+            return;
+        }
+        size_t n = grown();
+        T * data2 = Traits::allocate(alloc, n);
+
+        try {
+            Traits::construct(alloc, data2 + sz, std::forward<Args>(args)...);
+        } catch (...) {
+            Traits::deallocate(alloc, data2, n);
+            throw;
+        }
+        try {
+            relocateElements(alloc, data, sz, data2);
+        } catch (...) {
+            Traits::destroy(alloc, data2 + sz);
+            Traits::deallocate(alloc, data2, n);
+            throw;
+        }
+
+        deallocate();
+        data = data2;
+        cp = n;
+        ++sz;
+    }
+
+    // Appends [first, last) with at most one reallocation.
+    template <class It>
+    void appendRange(It first, It last, std::forward_iterator_tag) {
+        size_t n = std::distance(first, last);
+        if (sz + n > cp) {
+            reserve(std::max(sz + n, grown()));
+        }
+        size_t i = sz;
+        try {
+            for (; first != last; ++first, ++i) {
+                Traits::construct(alloc, data + i, *first);
+            }
+        } catch (...) {
+            destroy(sz, i);
+            throw;
+        }
+        sz = i;
+    }
+
+    // The length of a single-pass range is unknown up front.
+    template <class It>
+    void appendRange(It first, It last, std::input_iterator_tag) {
+        for (; first != last; ++first) {
+            emplace_back(*first);
+        }
+    }
 
 public:
+    using value_type = T;
+    using allocator_type = Alloc;
+
     size_t size() const {
         return sz;
     }
@@ -23,196 +229,115 @@ public:
         return sz == 0;
     }
 
+    Alloc get_allocator() const {
+        return alloc;
+    }
+
     void reserve(size_t n) {
         if (cp >= n) {
             return;
         }
 
-        T * data2 = static_cast<T*>(
-                operator new (n * sizeof(T)));
+        if constexpr (REALLOCATE) {
+            if (!this->isInline(data)) {
+                data = alloc.reallocate(data, cp, n);
+                cp = n;
+                return;
+            }
+        }
+
+        T * data2 = Traits::allocate(alloc, n);
 
-        size_t i = 0;
         try {
-            for (; i != sz; ++i) {
-                new (data2 + i) T(data[i]);
-            }
+            relocateElements(alloc, data, sz, data2);
         } catch (...) {
-            for (size_t j = 0; j != i; ++j) {
-                data2[i].~T();
-            }
-            operator delete(data2);
+            Traits::deallocate(alloc, data2, n);
             throw;
         }
 
-        for (size_t j = 0; j != sz; ++j) {
-            data[j].~T();
-        }
-        operator delete(data);
+        deallocate();
         data = data2;
         cp = n;
     }
 
     void clear() {
-        for (size_t j = 0; j != sz; ++j) {
-            data[j].~T();
-        }
+        destroy(0, sz);
         sz = 0;
     }
 
     void resize(size_t count) {
         if (sz >= count) {
-            for (size_t j = count; j != sz; ++j) {
-                data[j].~T();
-            }
+            destroy(count, sz);
             sz = count;
-        } else if (cp < count) {
-            T *data2 = static_cast<T*>(
-                    operator new(count * sizeof(T)));
-
-            size_t i = 0;
-            try {
-                for (; i < sz; ++i) {
-                    new (data2 + i) T(data[i]);
-                }
-                for (; i < count; ++i) {
-                    new (data2 + i) T();
-                }
-            } catch (...) {
-                for (size_t j = 0; j != i; ++j) {
-                    data2[i].~T();
-                }
-                operator delete(data2);
-                throw;
-            }
-
-            for (size_t j = 0; j != sz; ++j) {
-                data[j].~T();
-            }
-            operator delete(data);
-            data = data2;
-            sz = cp = count;
         } else {
+            if (cp < count) {
+                reserve(std::max(count, grown()));
+            }
             size_t i = sz;
             try {
                 for (; i != count; ++i) {
-                    new(data + i) T();
+                    Traits::construct(alloc, data + i);
                 }
             } catch (...) {
-                for (size_t j = 0; j != i; ++j) {
-                    data[j].~T();
-                }
-                sz = 0;
+                destroy(sz, i);
                 throw;
             }
             sz = count;
         }
     }
 
-    Vector() {
-        sz = 0;
-        cp = 0;
-        data = nullptr;
-    }
-
-    explicit Vector(size_t count) {
-        data = nullptr;
-        sz = 0;
-        cp = 0;
-        resize(count);
-    }
-
-    Vector(const Vector& v) {
-        data = nullptr;
-        sz = 0;
-        cp = 0;
-        data = static_cast<T*>(
-                operator new (v.size() * sizeof(T)));
-
-        for (size_t i = 0; i < sz; ++i) {
-            new (data + i) T(v.data[i]);
+    template <class... Args>
+    T& emplace_back(Args&&... args) {
+        if (sz == cp) {
+            growAndEmplace(std::forward<Args>(args)...);
+        } else {
+            Traits::construct(alloc, data + sz, std::forward<Args>(args)...);
+            ++sz;
         }
-        cp = sz = v.size();
+        return data[sz - 1];
     }
 
-    Vector(Vector&& v) {
-        cp = 0;
-        sz = 0;
-        data = nullptr;
-        std::swap(data, v.data);
-        std::swap(sz, v.sz);
-        std::swap(cp, v.cp);
+    void push_back(const T& val) {
+        emplace_back(val);
     }
 
-    Vector& operator= (const Vector& rhs) {
-        T * data2 = static_cast<T*>(
-                operator new (rhs.size() * sizeof(T)));
-
-        size_t i = 0;
-        try {
-            for (; i != rhs.size(); ++i) {
-                new (data2 + i) T(rhs.data[i]);
-            }
-        } catch (...) {
-            for (size_t j = 0; j != i; ++j) {
-                data2[j].~T();
-            }
-            operator delete(data2);
-            throw;
-        }
-
-        for (size_t j = 0; j != sz; ++j) {
-            data[j].~T();
-        }
-        operator delete(data);
-        data = data2;
-        cp = sz = rhs.size();
-        return *this;
+    void push_back(T&& val) {
+        emplace_back(std::move(val));
     }
 
-    Vector& operator= (Vector&& rhs) {
-        std::swap(data, rhs.data);
-        std::swap(sz, rhs.sz);
-        std::swap(cp, rhs.cp);
-
-        rhs.clear();
-        operator delete(rhs.data);
-        rhs.data = nullptr;
-        rhs.sz = rhs.cp = 0;
-
-        return *this;
+    // Inserts [first, last) before pos; the range must not point into this
+    // vector. Reallocates at most once for forward iterators.
+    template <class It>
+    T* insert(const T* pos, It first, It last) {
+        size_t index = pos - data;
+        size_t oldSize = sz;
+        appendRange(first, last, typename std::iterator_traits<It>::iterator_category());
+        std::rotate(data + index, data + oldSize, data + sz);
+        return data + index;
     }
 
-    ~Vector() {
-        for (size_t j = 0; j != sz; ++j) {
-            data[j].~T();
-        }
-        operator delete(data);
+    template <class Range>
+    void append(const Range& range) {
+        appendRange(std::begin(range), std::end(range),
+                    typename std::iterator_traits<decltype(std::begin(range))>::iterator_category());
     }
 
-    void push_back(const T& val) {
-        if (cp == 0) {
-            reserve(1);
-        } else if (sz == cp) {
-            reserve(cp * 2);
+    T* erase(const T* first, const T* last) {
+        T* from = data + (first - data);
+        if (first == last) {
+            return from;
         }
-        new (data + sz) T(val);
-        ++sz;
-    }
-
-    void push_back(T&& val) {
-        if (cp == 0) {
-            reserve(1);
-        } else if (sz == cp) {
-            reserve(cp * 2);
-        }
-
-        new (data + sz) T(std::move(val));
-        ++sz;
+        T* to = data + (last - data);
+        T* newEnd = std::move(to, end(), from);
+        size_t newSize = newEnd - data;
+        destroy(newSize, sz);
+        sz = newSize;
+        return from;
     }
 
     void pop_back() {
         --sz;
-        data[sz].~T();
+        Traits::destroy(alloc, data + sz);
     }
 
     T* begin() {
@@ -223,6 +348,14 @@ public:
         return data + size();
     }
 
+    const T* begin() const {
+        return data;
+    }
+
+    const T* end() const {
+        return data + size();
+    }
+
     T& operator[] (size_t index) {
         return data[index];
     }
@@ -231,3 +364,94 @@ public:
         return data[index];
     }
 };
+
+// Memory comes from Alloc through std::allocator_traits; the allocator is
+// carried over on copy, move and swap as its propagate_* traits say.
+template <class T, class Alloc = std::allocator<T> >
+class Vector : public VectorBase<T, Alloc, 0> {
+private:
+    using Base = VectorBase<T, Alloc, 0>;
+    using typename Base::Traits;
+    using Base::data;
+    using Base::sz;
+    using Base::cp;
+    using Base::alloc;
+    using Base::appendRange;
+    using Base::deallocate;
+
+    void swapStorage(Vector& other) {
+        std::swap(data, other.data);
+        std::swap(sz, other.sz);
+        std::swap(cp, other.cp);
+    }
+
+public:
+    using Base::clear;
+    using Base::resize;
+    using Base::begin;
+    using Base::end;
+
+    Vector()
+    : Base(Alloc()) {}
+
+    explicit Vector(const Alloc& alloc)
+    : Base(alloc) {}
+
+    explicit Vector(size_t count, const Alloc& alloc = Alloc())
+    : Base(alloc) {
+        resize(count);
+    }
+
+    Vector(const Vector& v)
+    : Vector(v, Traits::select_on_container_copy_construction(v.alloc)) {}
+
+    Vector(const Vector& v, const Alloc& alloc)
+    : Base(alloc) {
+        appendRange(v.begin(), v.end(), std::forward_iterator_tag());
+    }
+
+    Vector(Vector&& v)
+    : Base(v.alloc) {
+        swapStorage(v);
+    }
+
+    Vector& operator= (const Vector& rhs) {
+        if (this == &rhs) {
+            return *this;
+        }
+        Vector tmp(rhs, Traits::propagate_on_container_copy_assignment::value ? rhs.alloc : alloc);
+        swapStorage(tmp);
+        if constexpr (Traits::propagate_on_container_copy_assignment::value) {
+            std::swap(alloc, tmp.alloc);
+        }
+        return *this;
+    }
+
+    // Without propagation, memory from an unequal allocator cannot be
+    // taken over, so the elements are moved one by one.
+    Vector& operator= (Vector&& rhs) {
+        if (this == &rhs) {
+            return *this;
+        }
+        clear();
+        if (Traits::propagate_on_container_move_assignment::value || alloc == rhs.alloc) {
+            deallocate();
+            if constexpr (Traits::propagate_on_container_move_assignment::value) {
+                alloc = rhs.alloc;
+            }
+            swapStorage(rhs);
+        } else {
+            appendRange(std::make_move_iterator(rhs.begin()), std::make_move_iterator(rhs.end()),
+                        std::forward_iterator_tag());
+            rhs.clear();
+        }
+        return *this;
+    }
+
+    void swap(Vector& other) {
+        swapStorage(other);
+        if constexpr (Traits::propagate_on_container_swap::value) {
+            std::swap(alloc, other.alloc);
+        }
+    }
+};
@@ -0,0 +1,150 @@
+#include <algorithm>
+#include <cstdlib>
+#include <forward_list>
+#include <iostream>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "myVector.h"
+
+// Checks that Vector::append and Vector::insert with forward iterators
+// allocate at most once, by counting calls into the allocator, and that
+// erase keeps the remaining elements. Exits with a nonzero status on the
+// first failure.
+
+size_t allocations = 0;
+
+template <class T>
+struct CountingAllocator {
+    using value_type = T;
+
+    CountingAllocator() {}
+
+    template <class U>
+    CountingAllocator(const CountingAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        ++allocations;
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* p, size_t n) {
+        std::allocator<T>().deallocate(p, n);
+    }
+};
+
+template <class T, class U>
+bool operator==(const CountingAllocator<T>&, const CountingAllocator<U>&) {
+    return true;
+}
+
+template <class T, class U>
+bool operator!=(const CountingAllocator<T>&, const CountingAllocator<U>&) {
+    return false;
+}
+
+template <class T>
+using CountingVector = Vector<T, CountingAllocator<T> >;
+
+void check(bool ok, const std::string& what) {
+    if (!ok) {
+        std::cerr << "FAILED: " << what << std::endl;
+        std::exit(1);
+    }
+}
+
+template <class T>
+bool equals(const CountingVector<T>& v, const std::vector<T>& expected) {
+    return v.size() == expected.size() && std::equal(v.begin(), v.end(), expected.begin());
+}
+
+// Appends the same elements from a forward and a bidirectional range,
+// into an empty vector and into one that has to grow.
+template <class T>
+void checkAppend(const std::vector<T>& src, const std::string& type) {
+    std::forward_list<T> fwd(src.begin(), src.end());
+    std::list<T> bidir(src.begin(), src.end());
+
+    CountingVector<T> a;
+    allocations = 0;
+    a.append(fwd);
+    check(allocations <= 1 && equals(a, src), type + ": append to empty from forward_list");
+
+    allocations = 0;
+    a.append(bidir);
+    check(allocations <= 1 && a.size() == 2 * src.size(), type + ": append to full from list");
+
+    CountingVector<T> b;
+    b.reserve(src.size());
+    allocations = 0;
+    b.append(bidir);
+    check(allocations == 0 && equals(b, src), type + ": append within capacity");
+}
+
+template <class T>
+void checkInsert(const std::vector<T>& src, const std::string& type) {
+    std::forward_list<T> fwd(src.begin(), src.end());
+    CountingVector<T> v;
+    v.push_back(src.front());
+    v.push_back(src.back());
+    std::vector<T> expected(1, src.front());
+    expected.insert(expected.end(), src.begin(), src.end());
+    expected.push_back(src.back());
+
+    allocations = 0;
+    v.insert(v.begin() + 1, fwd.begin(), fwd.end());
+    check(allocations <= 1 && equals(v, expected), type + ": insert in the middle from forward_list");
+
+    allocations = 0;
+    v.insert(v.begin(), fwd.begin(), fwd.begin());
+    check(allocations == 0 && equals(v, expected), type + ": insert of an empty range");
+}
+
+// Erasing moves the tail down over the gap and must leave the elements
+// before and after it intact; an empty range changes nothing.
+template <class T>
+void checkErase(const std::vector<T>& src, const std::string& type) {
+    CountingVector<T> v;
+    v.append(src);
+
+    allocations = 0;
+    v.erase(v.begin() + 2, v.begin() + 2);
+    check(allocations == 0 && equals(v, src), type + ": erase of an empty range");
+
+    std::vector<T> expected(src);
+    expected.erase(expected.begin() + 2, expected.begin() + 4);
+    v.erase(v.begin() + 2, v.begin() + 4);
+    check(allocations == 0 && equals(v, expected), type + ": erase in the middle");
+}
+
+int main() {
+    std::vector<int> ints;
+    for (int i = 0; i < 1000; ++i) {
+        ints.push_back(i * 7);
+    }
+    std::vector<std::string> strings;
+    for (int i = 0; i < 100; ++i) {
+        strings.push_back(std::string(30, 'a' + i % 26));
+    }
+
+    checkAppend(ints, "int");
+    checkAppend(strings, "string");
+    checkInsert(ints, "int");
+    checkInsert(strings, "string");
+    checkErase(ints, "int");
+    checkErase(strings, "string");
+
+    // A single-pass range may grow the vector several times, but must still
+    // produce the right elements.
+    std::istringstream in("1 2 3 4 5 6 7 8 9 10");
+    CountingVector<int> v;
+    v.insert(v.begin(), std::istream_iterator<int>(in), std::istream_iterator<int>());
+    check(v.size() == 10 && v[9] == 10, "insert from istream_iterator");
+
+    std::cout << "OK" << std::endl;
+    return 0;
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+
+// Memory for small fixed-size objects cut from large chunks. Freed blocks
+// go to a free list of their size class and are handed out again before
+// the chunk is cut further, so node-based containers under insert/erase
+// churn stop calling the global allocator.
+class PoolResource {
+public:
+    static constexpr size_t ALIGN = alignof(std::max_align_t);
+    static constexpr size_t MAXSIZE = 256;
+
+    explicit PoolResource(size_t chunkSize = 64 * 1024)
+    : chunkSize(chunkSize)
+    , cur(nullptr)
+    , curEnd(nullptr) {
+        for (auto& head : freeLists) {
+            head = nullptr;
+        }
+    }
+
+    PoolResource(const PoolResource&) = delete;
+
+    PoolResource& operator=(const PoolResource&) = delete;
+
+    ~PoolResource() {
+        release();
+    }
+
+    // Sizes above MAXSIZE are not pooled and go to operator new.
+    void* allocate(size_t bytes) {
+        if (bytes > MAXSIZE) {
+            return operator new(bytes);
+        }
+        size_t cls = sizeClass(bytes);
+        if (freeLists[cls] != nullptr) {
+            FreeBlock* block = freeLists[cls];
+            freeLists[cls] = block->next;
+            return block;
+        }
+        size_t size = (cls + 1) * ALIGN;
+        if (cur == nullptr || static_cast<size_t>(curEnd - cur) < size) {
+            cur = static_cast<char*>(operator new(chunkSize));
+            curEnd = cur + chunkSize;
+            chunks.push_back(cur);
+        }
+        void* res = cur;
+        cur += size;
+        return res;
+    }
+
+    void deallocate(void* p, size_t bytes) {
+        if (bytes > MAXSIZE) {
+            operator delete(p);
+            return;
+        }
+        FreeBlock* block = static_cast<FreeBlock*>(p);
+        size_t cls = sizeClass(bytes);
+        block->next = freeLists[cls];
+        freeLists[cls] = block;
+    }
+
+    // Gives every chunk back at once, in O(chunks). Whatever was allocated
+    // from the pool must not be used afterwards.
+    void release() {
+        for (void* chunk : chunks) {
+            operator delete(chunk);
+        }
+        chunks.clear();
+        for (auto& head : freeLists) {
+            head = nullptr;
+        }
+        cur = curEnd = nullptr;
+    }
+
+    size_t chunkCount() const {
+        return chunks.size();
+    }
+
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    static size_t sizeClass(size_t bytes) {
+        return bytes == 0 ? 0 : (bytes - 1) / ALIGN;
+    }
+
+    size_t chunkSize;
+    char* cur;
+    char* curEnd;
+    std::vector<void*> chunks;
+    FreeBlock* freeLists[MAXSIZE / ALIGN];
+};
+
+
+// Allocator over a shared PoolResource. Copies and rebound copies use the
+// same pool, which lives as long as any of them; a default constructed
+// allocator starts a new pool. The pool is not thread-safe. Single
+// objects come from the pool, arrays and over-aligned types from operator
+// new.
+template<class T>
+class PoolAllocator {
+public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    PoolAllocator()
+    : pool(std::make_shared<PoolResource>()) {}
+
+    explicit PoolAllocator(std::shared_ptr<PoolResource> pool)
+    : pool(std::move(pool)) {}
+
+    template<class U>
+    PoolAllocator(const PoolAllocator<U>& other)
+    : pool(other.resource()) {}
+
+    T* allocate(size_t n) {
+        if (n == 1 && alignof(T) <= PoolResource::ALIGN) {
+            return static_cast<T*>(pool->allocate(sizeof(T)));
+        }
+        return static_cast<T*>(operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n) {
+        if (n == 1 && alignof(T) <= PoolResource::ALIGN) {
+            pool->deallocate(p, sizeof(T));
+        } else {
+            operator delete(p);
+        }
+    }
+
+    // A copied container gets a pool of its own, so two containers never
+    // share one unless asked to.
+    PoolAllocator select_on_container_copy_construction() const {
+        return PoolAllocator();
+    }
+
+    const std::shared_ptr<PoolResource>& resource() const {
+        return pool;
+    }
+
+private:
+    std::shared_ptr<PoolResource> pool;
+};
+
+template<class T, class U>
+bool operator==(const PoolAllocator<T>& a, const PoolAllocator<U>& b) {
+    return a.resource() == b.resource();
+}
+
+template<class T, class U>
+bool operator!=(const PoolAllocator<T>& a, const PoolAllocator<U>& b) {
+    return !(a == b);
+}
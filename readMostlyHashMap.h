@@ -0,0 +1,228 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "hashmap.h"
+
+
+// Epoch-based reclamation. A reader publishes the global epoch it saw in
+// its own slot for as long as it may hold a pointer; memory retired at
+// epoch e is freed once every busy slot holds an epoch past e.
+class EpochDomain {
+private:
+    static constexpr uint64_t IDLE = 0;
+
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> epoch{IDLE};
+        std::atomic<bool> owned{false};
+        size_t depth = 0;
+    };
+
+public:
+    static constexpr size_t MAXTHREADS = 256;
+
+    static EpochDomain& instance() {
+        static EpochDomain domain;
+        return domain;
+    }
+
+    // Pins the current epoch for the calling thread. Guards nest.
+    class Guard {
+    public:
+        Guard() : slot(EpochDomain::instance().threadSlot()) {
+            if (slot.depth++ == 0) {
+                auto& domain = EpochDomain::instance();
+                slot.epoch.store(domain.epoch.load());
+            }
+        }
+
+        Guard(const Guard&) = delete;
+
+        Guard& operator=(const Guard&) = delete;
+
+        ~Guard() {
+            if (--slot.depth == 0) {
+                slot.epoch.store(IDLE, std::memory_order_release);
+            }
+        }
+
+    private:
+        Slot& slot;
+    };
+
+    // Advances the epoch and returns the epoch an object unlinked before
+    // this call belongs to.
+    uint64_t retireEpoch() {
+        return epoch.fetch_add(1);
+    }
+
+    // Whether every reader that might still see an object retired at
+    // epoch e has left its critical section.
+    bool safe(uint64_t e) const {
+        for (size_t i = 0; i != MAXTHREADS; ++i) {
+            uint64_t seen = slots[i].epoch.load();
+            if (seen != IDLE && seen <= e) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    // Releases the thread's slot when the thread exits.
+    struct Owner {
+        Slot* slot = nullptr;
+
+        ~Owner() {
+            if (slot != nullptr) {
+                slot->owned.store(false, std::memory_order_release);
+            }
+        }
+    };
+
+    EpochDomain() : epoch(1) {}
+
+    Slot& threadSlot() {
+        thread_local Owner owner;
+        if (owner.slot == nullptr) {
+            for (size_t i = 0; i != MAXTHREADS; ++i) {
+                bool expected = false;
+                if (slots[i].owned.compare_exchange_strong(expected, true)) {
+                    owner.slot = &slots[i];
+                    break;
+                }
+            }
+            if (owner.slot == nullptr) {
+                throw std::runtime_error("too many reader threads");
+            }
+        }
+        return *owner.slot;
+    }
+
+    std::atomic<uint64_t> epoch;
+    Slot slots[MAXTHREADS];
+};
+
+
+// HashMap for tables that are read far more often than written. Readers
+// look the key up in an immutable snapshot without taking a lock; a writer
+// copies the snapshot, changes the copy and publishes it, and the old one
+// is freed once no reader can still be inside it. Every write costs a full
+// copy of the table, so group changes with update().
+template<class KeyType, class ValueType, class Hash = std::hash<KeyType> >
+class ReadMostlyHashMap {
+public:
+    using Map = HashMap<KeyType, ValueType, Hash>;
+
+    explicit ReadMostlyHashMap(Hash hasher = Hash())
+    : current(new Map(hasher)) {}
+
+    ReadMostlyHashMap(const ReadMostlyHashMap&) = delete;
+
+    ReadMostlyHashMap& operator=(const ReadMostlyHashMap&) = delete;
+
+    // No reader may be inside the map any more.
+    ~ReadMostlyHashMap() {
+        delete current.load();
+        for (auto& r : retired) {
+            delete r.first;
+        }
+    }
+
+    size_t size() const {
+        EpochDomain::Guard guard;
+        return current.load()->size();
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    bool find(const KeyType& key, ValueType& value) const {
+        EpochDomain::Guard guard;
+        const Map& map = *current.load();
+        auto it = map.find(key);
+        if (it == map.end()) {
+            return false;
+        }
+        value = it->second;
+        return true;
+    }
+
+    bool contains(const KeyType& key) const {
+        EpochDomain::Guard guard;
+        const Map& map = *current.load();
+        return map.find(key) != map.end();
+    }
+
+    // Calls fn(value) on the snapshot; the reference is only valid inside fn.
+    template<class F>
+    bool visit(const KeyType& key, F fn) const {
+        EpochDomain::Guard guard;
+        const Map& map = *current.load();
+        auto it = map.find(key);
+        if (it == map.end()) {
+            return false;
+        }
+        fn(it->second);
+        return true;
+    }
+
+    // Applies fn(Map&) to a copy of the table and publishes the result.
+    template<class F>
+    void update(F fn) {
+        std::lock_guard<std::mutex> lock(writer);
+        Map* next = new Map(*current.load());
+        try {
+            fn(*next);
+        } catch (...) {
+            delete next;
+            throw;
+        }
+        Map* old = current.exchange(next);
+        retired.emplace_back(old, EpochDomain::instance().retireEpoch());
+        reclaim();
+    }
+
+    void insert_or_assign(const KeyType& key, const ValueType& value) {
+        update([&](Map& map) {
+            map[key] = value;
+        });
+    }
+
+    void erase(const KeyType& key) {
+        update([&](Map& map) {
+            map.erase(key);
+        });
+    }
+
+    void clear() {
+        update([](Map& map) {
+            map.clear();
+        });
+    }
+
+private:
+    void reclaim() {
+        auto& domain = EpochDomain::instance();
+        size_t kept = 0;
+        for (size_t i = 0; i != retired.size(); ++i) {
+            if (domain.safe(retired[i].second)) {
+                delete retired[i].first;
+            } else {
+                retired[kept++] = retired[i];
+            }
+        }
+        retired.resize(kept);
+    }
+
+    std::atomic<Map*> current;
+    std::mutex writer;
+    std::vector<std::pair<Map*, uint64_t> > retired;
+};
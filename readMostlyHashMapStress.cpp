@@ -0,0 +1,178 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "readMostlyHashMap.h"
+
+// Stress test for ReadMostlyHashMap: reader threads look keys up while a
+// writer keeps publishing new snapshots, then a read-throughput check
+// compares lock-free reads with a mutex around a plain HashMap. Build it
+// with -fsanitize=thread (or address) to have a reader touching a freed
+// snapshot reported. Exits with a nonzero status on the first failure.
+
+const int KEYS = 1000;
+const int READERS = 4;
+const int UPDATES = 1000;
+const long ALIVE = 0x5AFE5AFE;
+
+std::atomic<long> liveValues(0);
+
+// Value that knows whether it has been destroyed. A snapshot freed while a
+// reader is inside it shows up as dead values, or as a race under TSan.
+struct Tracked {
+    long value;
+    long alive;
+
+    Tracked(long value = 0) : value(value), alive(ALIVE) {
+        ++liveValues;
+    }
+
+    Tracked(const Tracked& other) : value(other.value), alive(ALIVE) {
+        ++liveValues;
+    }
+
+    Tracked& operator=(const Tracked& other) {
+        value = other.value;
+        return *this;
+    }
+
+    ~Tracked() {
+        alive = 0;
+        --liveValues;
+    }
+};
+
+using Map = ReadMostlyHashMap<int, Tracked>;
+
+void check(bool ok, const std::string& what) {
+    if (!ok) {
+        std::cerr << "FAILED: " << what << std::endl;
+        std::exit(1);
+    }
+}
+
+// Every snapshot maps key i to generation * KEYS + i, and generations only
+// grow, so a reader must never see a value for another key or an older
+// generation than it saw before.
+void stress() {
+    Map map;
+    map.update([](Map::Map& m) {
+        for (int i = 0; i != KEYS; ++i) {
+            m[i] = Tracked(KEYS + i);
+        }
+    });
+
+    std::atomic<bool> stop(false);
+    std::atomic<bool> failed(false);
+    std::atomic<long> reads(0);
+    std::vector<std::thread> readers;
+    for (int r = 0; r != READERS; ++r) {
+        readers.emplace_back([&map, &stop, &failed, &reads, r] {
+            std::vector<long> seen(KEYS, 0);
+            long count = 0;
+            for (int i = r; !stop.load(); i = (i + 7) % KEYS) {
+                bool ok = map.visit(i, [&](const Tracked& t) {
+                    long generation = t.value / KEYS;
+                    if (t.alive != ALIVE || t.value % KEYS != i || generation < seen[i]) {
+                        failed = true;
+                    }
+                    seen[i] = generation;
+                });
+                if (!ok) {
+                    failed = true;
+                }
+                Tracked copy;
+                if (map.find(i, copy) && copy.value % KEYS != i) {
+                    failed = true;
+                }
+                ++count;
+            }
+            reads += count;
+        });
+    }
+
+    for (long generation = 2; generation != UPDATES + 2; ++generation) {
+        map.update([generation](Map::Map& m) {
+            for (int i = 0; i != KEYS; ++i) {
+                m[i].value = generation * KEYS + i;
+            }
+        });
+        // A key that comes and goes, so that erase publishes snapshots too.
+        if (generation % 2 == 0) {
+            map.insert_or_assign(KEYS, Tracked(generation));
+        } else {
+            map.erase(KEYS);
+        }
+    }
+    stop = true;
+    for (auto& t : readers) {
+        t.join();
+    }
+
+    check(!failed.load(), "readers saw a stale, foreign or destroyed value");
+    check(reads.load() > 0, "readers made no progress");
+    check(map.size() == KEYS, "size after the updates");
+    Tracked last;
+    check(map.find(KEYS - 1, last) && last.value == (UPDATES + 1) * KEYS + KEYS - 1,
+          "value of the last update");
+}
+
+// Reads per second from READERS threads, for ReadMostlyHashMap and for a
+// HashMap behind a mutex. Printed only: the ratio depends on the core count.
+void throughput() {
+    const int OPS = 200000;
+    Map map;
+    HashMap<int, Tracked> plain;
+    std::mutex mutex;
+    map.update([&plain](Map::Map& m) {
+        for (int i = 0; i != KEYS; ++i) {
+            m[i] = Tracked(i);
+            plain[i] = Tracked(i);
+        }
+    });
+
+    auto run = [](auto read) {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for (int r = 0; r != READERS; ++r) {
+            threads.emplace_back([&read] {
+                for (int i = 0; i != OPS; ++i) {
+                    read(i % KEYS);
+                }
+            });
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+        std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+        return READERS * OPS / time.count() / 1e6;
+    };
+
+    std::atomic<long> sum(0);
+    double lockFree = run([&](int key) {
+        map.visit(key, [&](const Tracked& t) {
+            sum.fetch_add(t.value, std::memory_order_relaxed);
+        });
+    });
+    double locked = run([&](int key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        sum.fetch_add(plain.find(key)->second.value, std::memory_order_relaxed);
+    });
+    check(sum.load() == 2L * READERS * (OPS / KEYS) * (KEYS * (KEYS - 1) / 2), "throughput sums");
+    std::cout << "reads: ReadMostlyHashMap " << lockFree << " M/s, mutex + HashMap "
+              << locked << " M/s" << std::endl;
+}
+
+int main() {
+    stress();
+    check(liveValues.load() == 0, "snapshots leaked");
+    throughput();
+    check(liveValues.load() == 0, "snapshots leaked");
+    std::cout << "OK" << std::endl;
+    return 0;
+}
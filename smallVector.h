@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+#include "myVector.h"
+
+// Vector that keeps up to N elements in a buffer inside the object and
+// only goes to the heap once it outgrows it. Everything but copying and
+// moving comes from VectorBase, so growth and relocation are the same as
+// in Vector.
+template <class T, size_t N>
+class SmallVector : public VectorBase<T, std::allocator<T>, N> {
+    static_assert(N > 0, "use Vector for no inline elements");
+
+private:
+    using Base = VectorBase<T, std::allocator<T>, N>;
+    using Base::data;
+    using Base::sz;
+    using Base::cp;
+    using Base::alloc;
+    using Base::appendRange;
+    using Base::deallocate;
+
+    // Takes the elements of v, which is left empty; this must be empty and
+    // inline.
+    void steal(SmallVector& v) {
+        if (v.isInline(v.data)) {
+            relocateElements(alloc, v.data, v.sz, data);
+        } else {
+            data = v.data;
+            cp = v.cp;
+            v.data = v.inlineData();
+            v.cp = N;
+        }
+        sz = v.sz;
+        v.sz = 0;
+    }
+
+public:
+    using Base::clear;
+    using Base::resize;
+    using Base::begin;
+    using Base::end;
+
+    static constexpr size_t INLINESIZE = N;
+
+    SmallVector()
+    : Base(std::allocator<T>()) {}
+
+    explicit SmallVector(size_t count)
+    : SmallVector() {
+        resize(count);
+    }
+
+    SmallVector(const SmallVector& v)
+    : SmallVector() {
+        appendRange(v.begin(), v.end(), std::forward_iterator_tag());
+    }
+
+    SmallVector(SmallVector&& v)
+    : SmallVector() {
+        steal(v);
+    }
+
+    SmallVector& operator= (const SmallVector& rhs) {
+        if (this != &rhs) {
+            SmallVector tmp(rhs);
+            clear();
+            deallocate();
+            steal(tmp);
+        }
+        return *this;
+    }
+
+    SmallVector& operator= (SmallVector&& rhs) {
+        if (this != &rhs) {
+            clear();
+            deallocate();
+            steal(rhs);
+        }
+        return *this;
+    }
+
+    // Whether the elements are still in the inline buffer.
+    bool is_inline() const {
+        return this->isInline(data);
+    }
+};
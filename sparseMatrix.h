@@ -0,0 +1,425 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "matrix.h"
+
+
+// Sparse matrix stored by compressed rows (CSR) or compressed columns
+// (CSC). The entries of major line l, a row in CSR and a column in CSC,
+// are values[offsets[l]] .. values[offsets[l + 1] - 1], and indices holds
+// their sorted positions along the line. Index is the type of those
+// positions: with 32 bits a double entry takes 12 bytes.
+template <typename T, typename Index = uint32_t>
+class SparseMatrix {
+public:
+    enum class Layout {
+        CSR,
+        CSC
+    };
+
+    struct Triplet {
+        size_t row;
+        size_t col;
+        T value;
+    };
+
+    SparseMatrix(size_t n, size_t m, Layout layout = Layout::CSR)
+    : n(n)
+    , m(m)
+    , form(layout) {
+        if (std::max(n, m) > std::numeric_limits<Index>::max()) {
+            throw std::out_of_range("sparse matrix too large for its index type");
+        }
+        offsets.assign(majorCount() + 1, 0);
+    }
+
+    // Entries at the same position are added up.
+    SparseMatrix(size_t n, size_t m, const std::vector<Triplet>& triplets, Layout layout = Layout::CSR)
+    : SparseMatrix(n, m, layout) {
+        // Counting sort by major line, then a sort along each line.
+        size_t majors = majorCount();
+        for (const Triplet& t : triplets) {
+            if (t.row >= n || t.col >= m) {
+                throw std::out_of_range("triplet outside the matrix");
+            }
+            ++offsets[major(t) + 1];
+        }
+        for (size_t l = 0; l != majors; ++l) {
+            offsets[l + 1] += offsets[l];
+        }
+        std::vector<std::pair<Index, T> > entries(triplets.size());
+        std::vector<size_t> next(offsets.begin(), offsets.end() - 1);
+        for (const Triplet& t : triplets) {
+            entries[next[major(t)]++] = std::make_pair(static_cast<Index>(minor(t)), t.value);
+        }
+        indices.reserve(entries.size());
+        values.reserve(entries.size());
+        size_t begin = 0;
+        for (size_t l = 0; l != majors; ++l) {
+            size_t end = offsets[l + 1];
+            std::sort(entries.begin() + begin, entries.begin() + end,
+                      [](const std::pair<Index, T>& a, const std::pair<Index, T>& b) {
+                          return a.first < b.first;
+                      });
+            for (size_t k = begin; k != end; ++k) {
+                if (k != begin && entries[k].first == indices.back()) {
+                    values.back() += entries[k].second;
+                } else {
+                    indices.push_back(entries[k].first);
+                    values.push_back(entries[k].second);
+                }
+            }
+            begin = end;
+            offsets[l + 1] = indices.size();
+        }
+    }
+
+    // Keeps the nonzero elements of a.
+    explicit SparseMatrix(const Matrix<T>& a, Layout layout = Layout::CSR)
+    : SparseMatrix(a.size().first, a.size().second, layout) {
+        size_t majors = majorCount();
+        size_t minors = layout == Layout::CSR ? m : n;
+        for (size_t l = 0; l != majors; ++l) {
+            for (size_t k = 0; k != minors; ++k) {
+                const T& x = layout == Layout::CSR ? a.data()[l * m + k] : a.data()[k * m + l];
+                if (x != T(0)) {
+                    indices.push_back(static_cast<Index>(k));
+                    values.push_back(x);
+                }
+            }
+            offsets[l + 1] = indices.size();
+        }
+    }
+
+    Matrix<T> dense() const {
+        Matrix<T> res(n, m, 0);
+        for (size_t l = 0; l != majorCount(); ++l) {
+            for (size_t k = offsets[l]; k != offsets[l + 1]; ++k) {
+                if (form == Layout::CSR) {
+                    res.set(l, indices[k], values[k]);
+                } else {
+                    res.set(indices[k], l, values[k]);
+                }
+            }
+        }
+        return res;
+    }
+
+    // The same matrix in the given layout, built with one counting pass.
+    SparseMatrix converted(Layout layout) const {
+        if (layout == form) {
+            return *this;
+        }
+        SparseMatrix res(n, m, layout);
+        size_t majors = res.majorCount();
+        for (Index k : indices) {
+            ++res.offsets[k + 1];
+        }
+        for (size_t l = 0; l != majors; ++l) {
+            res.offsets[l + 1] += res.offsets[l];
+        }
+        res.indices.resize(indices.size());
+        res.values.resize(values.size());
+        std::vector<size_t> next(res.offsets.begin(), res.offsets.end() - 1);
+        for (size_t l = 0; l != majorCount(); ++l) {
+            for (size_t k = offsets[l]; k != offsets[l + 1]; ++k) {
+                size_t pos = next[indices[k]]++;
+                res.indices[pos] = static_cast<Index>(l);
+                res.values[pos] = values[k];
+            }
+        }
+        return res;
+    }
+
+    // CSR of a is CSC of its transpose, so only the layout changes.
+    SparseMatrix transposed() const {
+        SparseMatrix res(*this);
+        std::swap(res.n, res.m);
+        res.form = form == Layout::CSR ? Layout::CSC : Layout::CSR;
+        return res;
+    }
+
+    std::pair<size_t, size_t> size() const {
+        return {n, m};
+    }
+
+    Layout layout() const {
+        return form;
+    }
+
+    size_t nonZeros() const {
+        return values.size();
+    }
+
+    // Bytes taken by the three arrays.
+    size_t memoryUsage() const {
+        return offsets.size() * sizeof(size_t) + indices.size() * sizeof(Index) + values.size() * sizeof(T);
+    }
+
+    T at(size_t i, size_t j) const {
+        if (i >= n || j >= m) {
+            throw std::out_of_range("sparse matrix index out of range");
+        }
+        size_t l = form == Layout::CSR ? i : j;
+        Index k = static_cast<Index>(form == Layout::CSR ? j : i);
+        auto first = indices.begin() + offsets[l];
+        auto last = indices.begin() + offsets[l + 1];
+        auto it = std::lower_bound(first, last, k);
+        return it != last && *it == k ? values[it - indices.begin()] : T(0);
+    }
+
+    std::vector<T> multiply(const std::vector<T>& x, const MatrixExecution& ex = MatrixExecution::current()) const {
+        std::vector<T> y;
+        multiply(x, y, ex);
+        return y;
+    }
+
+    // y = this * x, reusing the storage of y, which must not be x. Rows of
+    // a CSR matrix are split across threads; a CSC matrix scatters into y
+    // on the calling thread.
+    void multiply(const std::vector<T>& x, std::vector<T>& y,
+                  const MatrixExecution& ex = MatrixExecution::current()) const {
+        if (x.size() != m) {
+            throw std::out_of_range("vector size differs");
+        }
+        y.resize(n);
+        if (form == Layout::CSR) {
+            ex.forRanges(n, nonZeros() / std::max<size_t>(n, 1) + 1, [&](size_t from, size_t to) {
+                for (size_t i = from; i != to; ++i) {
+                    T acc = T(0);
+                    for (size_t k = offsets[i]; k != offsets[i + 1]; ++k) {
+                        acc += values[k] * x[indices[k]];
+                    }
+                    y[i] = acc;
+                }
+            });
+        } else {
+            std::fill(y.begin(), y.end(), T(0));
+            for (size_t j = 0; j != m; ++j) {
+                for (size_t k = offsets[j]; k != offsets[j + 1]; ++k) {
+                    y[indices[k]] += values[k] * x[j];
+                }
+            }
+        }
+    }
+
+    // this * b for a dense b: every entry adds a scaled row of b to a row
+    // of the result.
+    Matrix<T> multiply(const Matrix<T>& b, const MatrixExecution& ex = MatrixExecution::current()) const {
+        if (b.size().first != m) {
+            throw std::out_of_range("matrix sizes differ");
+        }
+        size_t k = b.size().second;
+        Matrix<T> res(n, k, 0);
+        const T* src = b.data();
+        T* dst = res.data();
+        auto addRow = [&](size_t i, size_t j, const T& x) {
+            const T* from = src + j * k;
+            T* to = dst + i * k;
+            for (size_t c = 0; c != k; ++c) {
+                to[c] += x * from[c];
+            }
+        };
+        if (form == Layout::CSR) {
+            ex.forRanges(n, (nonZeros() / std::max<size_t>(n, 1) + 1) * k, [&](size_t from, size_t to) {
+                for (size_t i = from; i != to; ++i) {
+                    for (size_t p = offsets[i]; p != offsets[i + 1]; ++p) {
+                        addRow(i, indices[p], values[p]);
+                    }
+                }
+            });
+        } else {
+            for (size_t j = 0; j != m; ++j) {
+                for (size_t p = offsets[j]; p != offsets[j + 1]; ++p) {
+                    addRow(indices[p], j, values[p]);
+                }
+            }
+        }
+        return res;
+    }
+
+private:
+    size_t majorCount() const {
+        return form == Layout::CSR ? n : m;
+    }
+
+    size_t major(const Triplet& t) const {
+        return form == Layout::CSR ? t.row : t.col;
+    }
+
+    size_t minor(const Triplet& t) const {
+        return form == Layout::CSR ? t.col : t.row;
+    }
+
+    size_t n, m;
+    Layout form;
+    std::vector<size_t> offsets;
+    std::vector<Index> indices;
+    std::vector<T> values;
+};
+
+template <typename T, typename Index>
+std::vector<T> operator* (const SparseMatrix<T, Index>& a, const std::vector<T>& x) {
+    return a.multiply(x);
+}
+
+template <typename T, typename Index>
+Matrix<T> operator* (const SparseMatrix<T, Index>& a, const Matrix<T>& b) {
+    return a.multiply(b);
+}
+
+
+// Result of an iterative solver. residual is the relative residual
+// |r| / |b| as tracked by the solver's recurrences; converged tells
+// whether it got below the tolerance. breakdown is set when the solver
+// stopped because a denominator vanished (or, for CG, p'Ap <= 0 showed a
+// is not positive definite); x is then the last iterate.
+template <typename T>
+struct SparseSolution {
+    std::vector<T> x;
+    size_t iterations;
+    T residual;
+    bool converged;
+    bool breakdown;
+};
+
+template <typename T>
+T sparseDot(const std::vector<T>& a, const std::vector<T>& b) {
+    T acc = T(0);
+    for (size_t i = 0; i != a.size(); ++i) {
+        acc += a[i] * b[i];
+    }
+    return acc;
+}
+
+// Conjugate gradient for a symmetric positive definite a, starting from
+// x = 0. Each iteration costs one product with a; maxIterations = 0 means
+// the size of the system.
+template <typename T, typename Index>
+SparseSolution<T> conjugateGradient(const SparseMatrix<T, Index>& a, const std::vector<T>& b,
+                                    T tolerance = T(1e-10), size_t maxIterations = 0,
+                                    const MatrixExecution& ex = MatrixExecution::current()) {
+    size_t n = b.size();
+    if (a.size().first != n || a.size().second != n) {
+        throw std::out_of_range("system sizes differ");
+    }
+    if (maxIterations == 0) {
+        maxIterations = n;
+    }
+    SparseSolution<T> res = {std::vector<T>(n, T(0)), 0, T(0), true, false};
+    T bNorm = std::sqrt(sparseDot(b, b));
+    if (bNorm == T(0)) {
+        return res;
+    }
+    std::vector<T> r(b);
+    std::vector<T> p(b);
+    std::vector<T> ap(n);
+    T rr = sparseDot(r, r);
+    res.residual = std::sqrt(rr) / bNorm;
+    res.converged = false;
+    while (res.iterations != maxIterations && !res.converged) {
+        ++res.iterations;
+        a.multiply(p, ap, ex);
+        T pap = sparseDot(p, ap);
+        if (!(pap > T(0))) {
+            res.breakdown = true;
+            break;
+        }
+        T alpha = rr / pap;
+        for (size_t i = 0; i != n; ++i) {
+            res.x[i] += alpha * p[i];
+            r[i] -= alpha * ap[i];
+        }
+        T rrNext = sparseDot(r, r);
+        res.residual = std::sqrt(rrNext) / bNorm;
+        res.converged = res.residual <= tolerance;
+        T beta = rrNext / rr;
+        for (size_t i = 0; i != n; ++i) {
+            p[i] = r[i] + beta * p[i];
+        }
+        rr = rrNext;
+    }
+    return res;
+}
+
+// BiCGSTAB for any nonsingular a, starting from x = 0. Each iteration
+// costs two products with a. Stops early, not converged and with
+// breakdown set, if the method breaks down.
+template <typename T, typename Index>
+SparseSolution<T> biCGStab(const SparseMatrix<T, Index>& a, const std::vector<T>& b,
+                           T tolerance = T(1e-10), size_t maxIterations = 0,
+                           const MatrixExecution& ex = MatrixExecution::current()) {
+    size_t n = b.size();
+    if (a.size().first != n || a.size().second != n) {
+        throw std::out_of_range("system sizes differ");
+    }
+    if (maxIterations == 0) {
+        maxIterations = n;
+    }
+    SparseSolution<T> res = {std::vector<T>(n, T(0)), 0, T(0), true, false};
+    T bNorm = std::sqrt(sparseDot(b, b));
+    if (bNorm == T(0)) {
+        return res;
+    }
+    std::vector<T> r(b);
+    const std::vector<T> shadow(b);
+    std::vector<T> p(n, T(0));
+    std::vector<T> v(n, T(0));
+    std::vector<T> s(n);
+    std::vector<T> t(n);
+    T rho = T(1);
+    T alpha = T(1);
+    T omega = T(1);
+    res.residual = T(1);
+    res.converged = false;
+    while (res.iterations != maxIterations && !res.converged) {
+        ++res.iterations;
+        T rhoNext = sparseDot(shadow, r);
+        if (rhoNext == T(0) || omega == T(0)) {
+            res.breakdown = true;
+            break;
+        }
+        T beta = rhoNext / rho * (alpha / omega);
+        for (size_t i = 0; i != n; ++i) {
+            p[i] = r[i] + beta * (p[i] - omega * v[i]);
+        }
+        a.multiply(p, v, ex);
+        T shadowV = sparseDot(shadow, v);
+        if (shadowV == T(0)) {
+            res.breakdown = true;
+            break;
+        }
+        alpha = rhoNext / shadowV;
+        for (size_t i = 0; i != n; ++i) {
+            s[i] = r[i] - alpha * v[i];
+        }
+        T sNorm = std::sqrt(sparseDot(s, s)) / bNorm;
+        if (sNorm <= tolerance) {
+            for (size_t i = 0; i != n; ++i) {
+                res.x[i] += alpha * p[i];
+            }
+            res.residual = sNorm;
+            res.converged = true;
+            break;
+        }
+        a.multiply(s, t, ex);
+        T tt = sparseDot(t, t);
+        omega = tt == T(0) ? T(0) : sparseDot(t, s) / tt;
+        for (size_t i = 0; i != n; ++i) {
+            res.x[i] += alpha * p[i] + omega * s[i];
+            r[i] = s[i] - omega * t[i];
+        }
+        res.residual = std::sqrt(sparseDot(r, r)) / bNorm;
+        res.converged = res.residual <= tolerance;
+        rho = rhoNext;
+    }
+    return res;
+}
@@ -0,0 +1,256 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+// Fixed set of worker threads, each with a deque of tasks. A worker runs
+// its newest task first, so nested work stays on the thread whose caches
+// hold its data, and when its deque runs dry it steals the oldest task of
+// another worker. A pool of size n runs n - 1 workers: the thread calling
+// run() does its share of the work as well, which also makes nested run()
+// calls safe.
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threads = std::thread::hardware_concurrency())
+    : pending(0)
+    , nextQueue(0)
+    , stopping(false) {
+        for (size_t i = 1; i < threads; ++i) {
+            queues.emplace_back(new WorkerQueue());
+        }
+        for (size_t i = 0; i != queues.size(); ++i) {
+            workers.emplace_back([this, i] { work(i); });
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeup.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    // Threads that take part in run(), the caller included.
+    size_t size() const {
+        return workers.size() + 1;
+    }
+
+    static ThreadPool& instance() {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    // Runs fn on a worker, or right away on the caller in a pool of size 1.
+    template<class F>
+    auto submit(F fn) -> std::future<decltype(fn())> {
+        using Result = decltype(fn());
+        auto task = std::make_shared<std::packaged_task<Result()> >(std::move(fn));
+        auto res = task->get_future();
+        if (workers.empty()) {
+            (*task)();
+        } else {
+            push([task] { (*task)(); });
+        }
+        return res;
+    }
+
+    // Calls fn(i) for every i in [0, tasks) and returns when all calls are
+    // done. The first exception thrown by fn is rethrown here.
+    template<class F>
+    void run(size_t tasks, F fn) {
+        if (tasks == 0) {
+            return;
+        }
+        auto batch = std::make_shared<Batch>(tasks);
+        // Helpers that start after the caller has drained the batch find
+        // no index left and never call fn.
+        size_t helpers = std::min(tasks - 1, workers.size());
+        for (size_t i = 0; i != helpers; ++i) {
+            push([batch, &fn] { batch->drain(fn); });
+        }
+        batch->drain(fn);
+        batch->wait();
+        if (batch->error) {
+            std::rethrow_exception(batch->error);
+        }
+    }
+
+private:
+    struct Batch {
+        explicit Batch(size_t tasks)
+        : tasks(tasks)
+        , next(0)
+        , done(0) {}
+
+        template<class F>
+        void drain(F& fn) {
+            for (size_t i = next++; i < tasks; i = next++) {
+                try {
+                    fn(i);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!error) {
+                        error = std::current_exception();
+                    }
+                }
+                if (++done == tasks) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    finished.notify_all();
+                }
+            }
+        }
+
+        void wait() {
+            std::unique_lock<std::mutex> lock(mutex);
+            finished.wait(lock, [this] { return done.load() == tasks; });
+        }
+
+        const size_t tasks;
+        std::atomic<size_t> next;
+        std::atomic<size_t> done;
+        std::mutex mutex;
+        std::condition_variable finished;
+        std::exception_ptr error;
+    };
+
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()> > tasks;
+    };
+
+    // The pool and deque of the worker running on this thread, if any.
+    struct WorkerId {
+        const ThreadPool* pool;
+        size_t index;
+    };
+
+    static WorkerId& currentWorker() {
+        static thread_local WorkerId id = {nullptr, 0};
+        return id;
+    }
+
+    // A worker pushes to its own deque, any other thread to the deques in
+    // turn.
+    void push(std::function<void()> task) {
+        const WorkerId& self = currentWorker();
+        size_t index = self.pool == this ? self.index : nextQueue++ % queues.size();
+        {
+            // Counted first, so a worker that sees no pending task cannot
+            // miss this one when it goes to sleep.
+            std::lock_guard<std::mutex> lock(mutex);
+            ++pending;
+        }
+        {
+            std::lock_guard<std::mutex> lock(queues[index]->mutex);
+            queues[index]->tasks.push_back(std::move(task));
+        }
+        wakeup.notify_one();
+    }
+
+    bool take(size_t index, std::function<void()>& task) {
+        {
+            WorkerQueue& own = *queues[index];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                --pending;
+                return true;
+            }
+        }
+        for (size_t i = 1; i != queues.size(); ++i) {
+            WorkerQueue& victim = *queues[(index + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                --pending;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void work(size_t index) {
+        currentWorker() = {this, index};
+        std::function<void()> task;
+        while (true) {
+            if (take(index, task)) {
+                task();
+                task = nullptr;
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeup.wait(lock, [this] { return stopping || pending.load() != 0; });
+            if (stopping && pending.load() == 0) {
+                return;
+            }
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<WorkerQueue> > queues;
+    // Tasks pushed and not yet taken.
+    std::atomic<size_t> pending;
+    std::atomic<size_t> nextQueue;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    bool stopping;
+};
+
+
+// Contiguous ranges [begin(i), end(i)) that count items are cut into for
+// a pool of threads threads, when each item costs about cost elements of
+// work: up to four per thread for balance, but none under GRAIN elements
+// of work, which is not worth waking another thread for. There is always
+// at least one range, and none is empty unless count is 0.
+class ThreadPoolSplit {
+public:
+    static constexpr size_t GRAIN = 1 << 15;
+
+    ThreadPoolSplit(size_t count, size_t threads, size_t cost = 1)
+    : n(count) {
+        size_t parts = threads > 1 ? std::min(count, threads * 4) : 1;
+        parts = std::max<size_t>(1, std::min(parts, count * std::max<size_t>(cost, 1) / GRAIN));
+        step = std::max<size_t>(1, (n + parts - 1) / parts);
+        chunks = std::max<size_t>(1, (n + step - 1) / step);
+    }
+
+    size_t count() const {
+        return chunks;
+    }
+
+    size_t begin(size_t i) const {
+        return std::min(n, i * step);
+    }
+
+    size_t end(size_t i) const {
+        return std::min(n, (i + 1) * step);
+    }
+
+private:
+    size_t n;
+    size_t chunks;
+    size_t step;
+};
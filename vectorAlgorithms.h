@@ -0,0 +1,129 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <type_traits>
+#include <vector>
+
+#include "myVector.h"
+#include "threadPool.h"
+
+
+// Bulk operations over Vector. The buffer is cut into one contiguous range
+// per pool task by ThreadPoolSplit, and every task runs a plain loop over
+// raw pointers, which the compiler vectorizes for arithmetic element types.
+
+// op folded over n > 0 elements from p. If Reorder is set, arithmetic
+// types are folded in independent lanes, so the loop maps onto SIMD
+// registers even for floating point, where the compiler may not reorder
+// on its own; op must then be commutative.
+template <bool Reorder, class T, class Op>
+T reduceRange(const T* p, size_t n, Op op) {
+    constexpr size_t LANES = 8;
+    if constexpr (Reorder && std::is_arithmetic<T>::value) {
+        if (n >= 2 * LANES) {
+            T lanes[LANES];
+            std::copy(p, p + LANES, lanes);
+            size_t i = LANES;
+            for (; i + LANES <= n; i += LANES) {
+                for (size_t k = 0; k != LANES; ++k) {
+                    lanes[k] = op(lanes[k], p[i + k]);
+                }
+            }
+            T acc = lanes[0];
+            for (size_t k = 1; k != LANES; ++k) {
+                acc = op(acc, lanes[k]);
+            }
+            for (; i != n; ++i) {
+                acc = op(acc, p[i]);
+            }
+            return acc;
+        }
+    }
+    T acc = p[0];
+    for (size_t i = 1; i != n; ++i) {
+        acc = op(acc, p[i]);
+    }
+    return acc;
+}
+
+template <class T, class A>
+void parallel_fill(Vector<T, A>& v, const T& value, ThreadPool& pool = ThreadPool::instance()) {
+    T* data = v.begin();
+    ThreadPoolSplit split(v.size(), pool.size());
+    pool.run(split.count(), [&](size_t i) {
+        std::fill(data + split.begin(i), data + split.end(i), value);
+    });
+}
+
+// dst[i] = f(src[i]); dst is resized to src.size() and may be src itself.
+template <class T, class A, class U, class B, class F>
+void parallel_transform(const Vector<T, A>& src, Vector<U, B>& dst, F f,
+                        ThreadPool& pool = ThreadPool::instance()) {
+    dst.resize(src.size());
+    const T* in = src.begin();
+    U* out = dst.begin();
+    ThreadPoolSplit split(src.size(), pool.size());
+    pool.run(split.count(), [&](size_t i) {
+        for (size_t j = split.begin(i), end = split.end(i); j != end; ++j) {
+            out[j] = f(in[j]);
+        }
+    });
+}
+
+// Like std::reduce: op must be associative and commutative, as elements
+// are combined in no particular order.
+template <class T, class A, class Op = std::plus<T> >
+T parallel_reduce(const Vector<T, A>& v, T init, Op op = Op(),
+                  ThreadPool& pool = ThreadPool::instance()) {
+    if (v.empty()) {
+        return init;
+    }
+    const T* data = v.begin();
+    ThreadPoolSplit split(v.size(), pool.size());
+    std::vector<T> partial(split.count());
+    pool.run(split.count(), [&](size_t i) {
+        partial[i] = reduceRange<true>(data + split.begin(i), split.end(i) - split.begin(i), op);
+    });
+    T res = op(init, partial[0]);
+    for (size_t i = 1; i != partial.size(); ++i) {
+        res = op(res, partial[i]);
+    }
+    return res;
+}
+
+// dst[i] = src[0] op ... op src[i]; dst is resized to src.size() and may
+// be src itself. op must be associative. Each range is first reduced to
+// its total, then scanned starting from the totals of the ranges before
+// it, so the buffer is read twice and written once.
+template <class T, class A, class B, class Op = std::plus<T> >
+void parallel_inclusive_scan(const Vector<T, A>& src, Vector<T, B>& dst, Op op = Op(),
+                             ThreadPool& pool = ThreadPool::instance()) {
+    size_t n = src.size();
+    dst.resize(n);
+    if (n == 0) {
+        return;
+    }
+    const T* in = src.begin();
+    T* out = dst.begin();
+    ThreadPoolSplit split(n, pool.size());
+    // offset[i] folds the ranges before range i.
+    std::vector<T> offset(split.count());
+    pool.run(split.count() - 1, [&](size_t i) {
+        offset[i + 1] = reduceRange<false>(in + split.begin(i), split.end(i) - split.begin(i), op);
+    });
+    for (size_t i = 2; i < offset.size(); ++i) {
+        offset[i] = op(offset[i - 1], offset[i]);
+    }
+    pool.run(split.count(), [&](size_t i) {
+        size_t j = split.begin(i);
+        size_t end = split.end(i);
+        T acc = i == 0 ? in[j] : op(offset[i], in[j]);
+        out[j] = acc;
+        for (++j; j != end; ++j) {
+            acc = op(acc, in[j]);
+            out[j] = acc;
+        }
+    });
+}